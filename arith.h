@@ -0,0 +1,37 @@
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <climits>
+
+// Arithmetic on values, shared by all of the execution engines so
+// that they produce identical results.  Overflow wraps around (two's
+// complement), rather than being undefined behavior.  Division by
+// zero must be checked by the caller, which knows the location to
+// report it at.
+
+namespace arith {
+
+inline long add(long a, long b) {
+  return long((unsigned long) a + (unsigned long) b);
+}
+
+inline long sub(long a, long b) {
+  return long((unsigned long) a - (unsigned long) b);
+}
+
+inline long mul(long a, long b) {
+  return long((unsigned long) a * (unsigned long) b);
+}
+
+// b must not be 0
+inline long div(long a, long b) {
+  // LONG_MIN / -1 overflows: it wraps around to LONG_MIN
+  if (b == -1) {
+    return long(0UL - (unsigned long) a);
+  }
+  return a / b;
+}
+
+}
+
+#endif // ARITH_H
@@ -0,0 +1,225 @@
+#include <cstdio>
+#include <cassert>
+#include "cpputil.h"
+#include "token.h"
+#include "exceptions.h"
+#include "ast.h"
+
+////////////////////////////////////////////////////////////////////////
+// FlatAst implementation
+////////////////////////////////////////////////////////////////////////
+
+FlatAst::FlatAst() {
+}
+
+FlatAst::~FlatAst() {
+}
+
+void FlatAst::add_unit(Node *unit) {
+  // the children of the (U)nit are a sequence of (E)xpressions,
+  // each followed by a semicolon
+  unsigned num_kids = unit->get_num_kids();
+  for (unsigned i = 0; i < num_kids; i += 2) {
+    add_statement(unit->get_kid(i));
+  }
+}
+
+// The parse tree is traversed in preorder using an explicit worklist.
+// Each worklist entry is an E node, along with the index of the binary
+// operator node (if any) whose right operand it is: that operator's
+// right operand index is filled in when the E node is lowered.
+unsigned FlatAst::add_statement(Node *expr) {
+  unsigned stmt = begin_statement();
+
+  m_work.clear();
+  m_work.push_back({ expr, NO_NODE });
+
+  while (!m_work.empty()) {
+    Node *e = m_work.back().first;
+    unsigned patch = m_work.back().second;
+    m_work.pop_back();
+
+    unsigned index = get_num_nodes();
+    if (patch != NO_NODE) {
+      m_right[patch] = index;
+    }
+
+    Node *first = e->get_kid(0);
+    AstOp op;
+    long payload = 0;
+
+    switch (first->get_tag()) {
+    case TOK_INTEGER_LITERAL:
+      op = AST_LITERAL;
+      payload = first->get_ival();
+      break;
+    case TOK_IDENTIFIER:
+      // a variable's slot is its symbol id
+      op = AST_VAR;
+      payload = first->get_sym();
+      break;
+    case TOK_ASSIGN:
+      op = AST_ASSIGN;
+      payload = e->get_kid(1)->get_sym();
+      m_work.push_back({ e->get_kid(2), NO_NODE });
+      break;
+    case TOK_PLUS:
+    case TOK_MINUS:
+    case TOK_TIMES:
+    case TOK_DIVIDE:
+      op = (first->get_tag() == TOK_PLUS) ? AST_ADD
+         : (first->get_tag() == TOK_MINUS) ? AST_SUB
+         : (first->get_tag() == TOK_TIMES) ? AST_MUL
+         : AST_DIV;
+      // right operand is pushed first, so that the left operand
+      // is lowered immediately after this node
+      m_work.push_back({ e->get_kid(2), index });
+      m_work.push_back({ e->get_kid(1), NO_NODE });
+      break;
+    default:
+      RuntimeError::raise("Unknown operator: %d", first->get_tag());
+    }
+
+    add_node(op, payload, e->get_loc());
+  }
+
+  return stmt;
+}
+
+unsigned FlatAst::begin_statement() {
+  m_stmts.push_back(get_num_nodes());
+  return unsigned(m_stmts.size() - 1);
+}
+
+unsigned FlatAst::add_node(AstOp op, long payload, const Location &loc) {
+  m_ops.push_back((unsigned char) op);
+  m_right.push_back(0);
+  m_payload.push_back(payload);
+  m_locs.push_back(loc);
+  return unsigned(m_ops.size() - 1);
+}
+
+unsigned FlatAst::copy_statement(const FlatAst &from, unsigned stmt) {
+  unsigned result = begin_statement();
+  unsigned begin = from.get_statement(stmt), end = from.get_statement_end(stmt);
+  unsigned offset = get_num_nodes() - begin;
+
+  for (unsigned i = begin; i < end; i++) {
+    unsigned index = add_node(from.get_op(i), from.get_payload(i), from.get_loc(i));
+    if (is_binary(from.get_op(i))) {
+      set_right(index, from.get_right(i) + offset);
+    }
+  }
+
+  return result;
+}
+
+void FlatAst::load(unsigned num_nodes, const unsigned char *ops, const unsigned *right,
+                   const long *payloads, unsigned src, const uint64_t *offsets,
+                   unsigned num_stmts, const unsigned *stmts) {
+  m_ops.assign(ops, ops + num_nodes);
+  m_right.assign(right, right + num_nodes);
+  m_payload.assign(payloads, payloads + num_nodes);
+  m_locs.resize(num_nodes);
+  for (unsigned i = 0; i < num_nodes; i++) {
+    m_locs[i] = Location(src, (unsigned long) offsets[i]);
+  }
+  m_stmts.assign(stmts, stmts + num_stmts);
+}
+
+void FlatAst::clear() {
+  m_ops.clear();
+  m_right.clear();
+  m_payload.clear();
+  m_locs.clear();
+  m_stmts.clear();
+}
+
+const char *FlatAst::op_to_string(AstOp op) {
+  switch (op) {
+  case AST_LITERAL:
+    return "LITERAL";
+  case AST_VAR:
+    return "VAR";
+  case AST_ASSIGN:
+    return "ASSIGN";
+  case AST_ADD:
+    return "ADD";
+  case AST_SUB:
+    return "SUB";
+  case AST_MUL:
+    return "MUL";
+  case AST_DIV:
+    return "DIV";
+  default:
+    RuntimeError::raise("Unknown AST op: %d", int(op));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////
+// FlatAstPrint implementation
+////////////////////////////////////////////////////////////////////////
+
+FlatAstPrint::FlatAstPrint(const SymbolTable *symtab)
+  : m_symtab(symtab) {
+}
+
+FlatAstPrint::~FlatAstPrint() {
+}
+
+// The tree is printed in preorder, which is simply the order of the
+// nodes in the AST.  A stack records, for each node whose operands are
+// still being printed, how many operands remain: this determines both
+// the depth of each node and whether a vertical line must be drawn
+// for each level.
+void FlatAstPrint::print(const FlatAst &ast) const {
+  std::vector<unsigned> remaining;
+
+  printf("UNIT\n");
+  remaining.push_back(ast.get_num_statements());
+
+  unsigned num_nodes = ast.get_num_nodes();
+  for (unsigned i = 0; i < num_nodes; i++) {
+    // pop levels whose operands have all been printed
+    while (!remaining.empty() && remaining.back() == 0) {
+      remaining.pop_back();
+    }
+    assert(!remaining.empty());
+
+    unsigned depth = unsigned(remaining.size());
+    remaining.back()--;
+    for (unsigned level = 0; level + 1 < depth; level++) {
+      fputs(remaining[level] > 0 ? "|  " : "   ", stdout);
+    }
+    printf("+--%s", FlatAst::op_to_string(ast.get_op(i)));
+
+    std::string str = node_str(ast, i);
+    if (!str.empty()) {
+      printf("[%s]", str.c_str());
+    }
+    printf("\n");
+
+    AstOp op = ast.get_op(i);
+    if (op == AST_ASSIGN) {
+      remaining.push_back(1);
+    } else if (FlatAst::is_binary(op)) {
+      remaining.push_back(2);
+    }
+  }
+}
+
+std::string FlatAstPrint::node_str(const FlatAst &ast, unsigned i) const {
+  long payload = ast.get_payload(i);
+  switch (ast.get_op(i)) {
+  case AST_LITERAL:
+    return cpputil::format("%ld", payload);
+  case AST_VAR:
+  case AST_ASSIGN:
+    if (m_symtab != nullptr) {
+      return m_symtab->get_name(unsigned(payload));
+    }
+    return cpputil::format("slot %ld", payload);
+  default:
+    return "";
+  }
+}
@@ -0,0 +1,118 @@
+#ifndef AST_H
+#define AST_H
+
+#include <vector>
+#include <string>
+#include "location.h"
+#include "node.h"
+#include "symtab.h"
+
+// Operations in the flat AST.
+enum AstOp {
+  AST_LITERAL,   // integer literal: payload is its value
+  AST_VAR,       // variable reference: payload is its slot
+  AST_ASSIGN,    // assignment: payload is the slot assigned to
+  AST_ADD,
+  AST_SUB,
+  AST_MUL,
+  AST_DIV,
+};
+
+// A flat AST stores the expressions of a unit in parallel arrays
+// (struct of arrays), rather than as a graph of Nodes.  Each
+// statement's expression is stored in preorder, and statements are
+// stored one after another, so a node's first operand always
+// immediately follows it, and evaluating a unit is a sequential
+// scan of memory.  Unlike the parse tree, there are no wrapper
+// nodes for E or ; and the operator is the node itself.
+class FlatAst {
+private:
+  std::vector<unsigned char> m_ops;   // AstOp for each node
+  std::vector<unsigned> m_right;      // index of right operand of binary operators
+  std::vector<long> m_payload;        // literal value or variable slot
+  std::vector<Location> m_locs;       // source location of each node
+  std::vector<unsigned> m_stmts;      // index of each statement's root node
+
+  // worklist used when lowering a parse tree
+  std::vector<std::pair<Node *, unsigned>> m_work;
+
+  // no value semantics
+  FlatAst(const FlatAst &);
+  FlatAst &operator=(const FlatAst &);
+
+public:
+  enum { NO_NODE = ~0u };
+
+  FlatAst();
+  ~FlatAst();
+
+  // Lower all of the statements in a parse tree (U node)
+  void add_unit(Node *unit);
+
+  // Lower a single statement (E node) from a parse tree, appending
+  // it to the AST.  Returns the statement's index.
+  unsigned add_statement(Node *expr);
+
+  // Functions for building an AST directly (e.g., by an optimization
+  // pass): begin_statement starts a new statement, whose nodes must
+  // then be added in preorder.  The right operand of each binary
+  // operator must be set once its index is known.
+  unsigned begin_statement();
+  unsigned add_node(AstOp op, long payload, const Location &loc);
+  void set_right(unsigned node, unsigned right) { m_right[node] = right; }
+
+  // Append a copy of a statement from another AST.  Returns the index
+  // of the new statement.
+  unsigned copy_statement(const FlatAst &from, unsigned stmt);
+
+  // Replace the contents with nodes and statements given as arrays
+  // (e.g., read from a cache file).  The location of node i is byte
+  // offset offsets[i] of source src.
+  void load(unsigned num_nodes, const unsigned char *ops, const unsigned *right,
+            const long *payloads, unsigned src, const uint64_t *offsets,
+            unsigned num_stmts, const unsigned *stmts);
+
+  // Remove all nodes and statements
+  void clear();
+
+  unsigned get_num_nodes() const { return unsigned(m_ops.size()); }
+  AstOp get_op(unsigned i) const { return AstOp(m_ops[i]); }
+  unsigned get_left(unsigned i) const { return i + 1; }
+  unsigned get_right(unsigned i) const { return m_right[i]; }
+  long get_payload(unsigned i) const { return m_payload[i]; }
+  const Location &get_loc(unsigned i) const { return m_locs[i]; }
+
+  // Direct access to the arrays, for code which scans them
+  const unsigned char *get_ops() const { return m_ops.data(); }
+  const long *get_payloads() const { return m_payload.data(); }
+  const unsigned *get_rights() const { return m_right.data(); }
+
+  unsigned get_num_statements() const { return unsigned(m_stmts.size()); }
+  // index of the root node of given statement
+  unsigned get_statement(unsigned stmt) const { return m_stmts[stmt]; }
+  // index one past the last node of given statement
+  unsigned get_statement_end(unsigned stmt) const {
+    return stmt + 1 < m_stmts.size() ? m_stmts[stmt + 1] : get_num_nodes();
+  }
+
+  static bool is_binary(AstOp op) { return op >= AST_ADD; }
+  static const char *op_to_string(AstOp op);
+};
+
+// Print a FlatAst in the same tree format as TreePrint uses for
+// the parse tree.
+class FlatAstPrint {
+private:
+  const SymbolTable *m_symtab;
+
+public:
+  FlatAstPrint(const SymbolTable *symtab = nullptr);
+  ~FlatAstPrint();
+
+  void print(const FlatAst &ast) const;
+
+private:
+  std::string node_str(const FlatAst &ast, unsigned i) const;
+};
+
+#endif // AST_H
@@ -0,0 +1,380 @@
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include "exceptions.h"
+#include "arith.h"
+#include "batch.h"
+
+#if defined(__x86_64__)
+#  define BATCH_X86 1
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+// maximum number of rows in a block, and maximum number of values
+// in the stack (which has one column per entry)
+const unsigned MAX_BLOCK_SIZE = 1024;
+const unsigned MAX_STACK_VALUES = 1 << 22;
+
+// block sizes are a multiple of this, so the vector loops
+// have no leftover elements
+const unsigned ROW_ALIGN = 4;
+
+// Column names are used as variable names, which are the same as
+// identifiers in programs
+bool is_name(const std::string &s) {
+  if (s.empty()) {
+    return false;
+  }
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    if (!((*i >= 'a' && *i <= 'z') || (*i >= 'A' && *i <= 'Z'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Scalar implementation
+////////////////////////////////////////////////////////////////////////
+
+void add_scalar(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    left[i] = arith::add(left[i], right[i]);
+  }
+}
+
+void sub_scalar(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    left[i] = arith::sub(left[i], right[i]);
+  }
+}
+
+void mul_scalar(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i++) {
+    left[i] = arith::mul(left[i], right[i]);
+  }
+}
+
+#ifdef BATCH_X86
+
+////////////////////////////////////////////////////////////////////////
+// AVX2 implementation
+////////////////////////////////////////////////////////////////////////
+
+// Vector adds, subtracts, and multiplies wrap around, the same way the
+// arith functions do.  AVX2 has no 64 bit multiply, so the low 64 bits
+// of each product are computed from 32 bit halves: lo*lo plus the
+// cross products shifted left by 32 (hi*hi only affects the high bits).
+
+#define BATCH_AVX2 __attribute__ ((target ("avx2")))
+
+BATCH_AVX2 void add_avx2(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(right + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i), _mm256_add_epi64(a, b));
+  }
+}
+
+BATCH_AVX2 void sub_avx2(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(right + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i), _mm256_sub_epi64(a, b));
+  }
+}
+
+BATCH_AVX2 void mul_avx2(long *left, const long *right, unsigned n) {
+  for (unsigned i = 0; i < n; i += 4) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(right + i));
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    __m256i prod = _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(left + i), prod);
+  }
+}
+
+#endif // BATCH_X86
+
+////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////////////////////////////
+
+struct BlockImpl {
+  const char *name;
+  void (*add)(long *left, const long *right, unsigned n);
+  void (*sub)(long *left, const long *right, unsigned n);
+  void (*mul)(long *left, const long *right, unsigned n);
+};
+
+const BlockImpl s_scalar = { "scalar", add_scalar, sub_scalar, mul_scalar };
+#ifdef BATCH_X86
+const BlockImpl s_avx2 = { "avx2", add_avx2, sub_avx2, mul_avx2 };
+#endif
+
+const BlockImpl *find_impl() {
+#ifdef BATCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &s_avx2;
+  }
+#endif
+  return &s_scalar;
+}
+
+const BlockImpl *s_impl = find_impl();
+
+} // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////
+// BatchEvaluator implementation
+////////////////////////////////////////////////////////////////////////
+
+BatchEvaluator::BatchEvaluator(const Bytecode *code, Environment *env)
+  : m_code(code)
+  , m_env(env) {
+  m_env->resolve_slots();
+
+  unsigned depth = std::max(1u, code->get_max_depth());
+  m_block_size = std::min(MAX_BLOCK_SIZE, MAX_STACK_VALUES / depth);
+  m_block_size = std::max(ROW_ALIGN, m_block_size - m_block_size % ROW_ALIGN);
+
+  m_stack.resize(size_t(depth) * m_block_size);
+  m_result.resize(m_block_size);
+  m_error_pc.resize(m_block_size);
+}
+
+BatchEvaluator::~BatchEvaluator() {
+}
+
+void BatchEvaluator::eval(unsigned num_rows, long *values, unsigned char *defined) {
+  const Insn *code = m_code->get_code();
+  unsigned num_insns = m_code->get_num_insns();
+  unsigned block = m_block_size;
+
+  // the arithmetic is done on whole vectors, so round up the number
+  // of rows (the extra rows are ignored)
+  unsigned n = (num_rows + ROW_ALIGN - 1) / ROW_ALIGN * ROW_ALIGN;
+
+  std::fill(m_error_pc.begin(), m_error_pc.end(), unsigned(NO_ERROR));
+
+  // the stack has depth entries, and column i of the stack is
+  // stack + i*block
+  long *stack = m_stack.data();
+  size_t depth = 0;
+
+  for (unsigned pc = 0; pc < num_insns; pc++) {
+    const Insn &insn = code[pc];
+    switch (insn.op) {
+    case OP_PUSH:
+      std::fill(stack + depth * block, stack + depth * block + n, insn.arg);
+      depth++;
+      break;
+
+    case OP_LOAD: {
+      const long *col = values + size_t(insn.arg) * block;
+      const unsigned char *def = defined + size_t(insn.arg) * block;
+      for (unsigned r = 0; r < num_rows; r++) {
+        if (!def[r] && m_error_pc[r] == NO_ERROR) {
+          m_error_pc[r] = pc;
+        }
+      }
+      memcpy(stack + depth * block, col, n * sizeof(long));
+      depth++;
+      break;
+    }
+
+    case OP_STORE:
+      memcpy(values + size_t(insn.arg) * block, stack + (depth - 1) * block, n * sizeof(long));
+      memset(defined + size_t(insn.arg) * block, 1, n);
+      break;
+
+    case OP_ADD:
+      depth--;
+      s_impl->add(stack + (depth - 1) * block, stack + depth * block, n);
+      break;
+
+    case OP_SUB:
+      depth--;
+      s_impl->sub(stack + (depth - 1) * block, stack + depth * block, n);
+      break;
+
+    case OP_MUL:
+      depth--;
+      s_impl->mul(stack + (depth - 1) * block, stack + depth * block, n);
+      break;
+
+    case OP_DIV: {
+      // rows which have already failed might divide by zero, so
+      // they are skipped
+      depth--;
+      long *left = stack + (depth - 1) * block;
+      const long *right = stack + depth * block;
+      for (unsigned r = 0; r < num_rows; r++) {
+        if (m_error_pc[r] != NO_ERROR) {
+          left[r] = 0;
+        } else if (right[r] == 0) {
+          m_error_pc[r] = pc;
+          left[r] = 0;
+        } else {
+          left[r] = arith::div(left[r], right[r]);
+        }
+      }
+      break;
+    }
+
+    case OP_POP:
+      depth--;
+      break;
+
+    case OP_HALT: {
+      const long *top = stack + (depth - 1) * block;
+      std::copy(top, top + num_rows, m_result.begin());
+      break;
+    }
+
+    default:
+      RuntimeError::raise("Unknown opcode: %d", int(insn.op));
+    }
+  }
+}
+
+void BatchEvaluator::raise_error(unsigned row) const {
+  unsigned pc = m_error_pc[row];
+  const Insn &insn = m_code->get_code()[pc];
+  if (insn.op == OP_LOAD) {
+    m_env->undefined_variable(m_code->get_loc(pc), unsigned(insn.arg));
+  }
+  EvaluationError::raise(m_code->get_loc(pc), "Division by zero");
+}
+
+const char *BatchEvaluator::get_impl_name() {
+  return s_impl->name;
+}
+
+////////////////////////////////////////////////////////////////////////
+// CsvReader implementation
+////////////////////////////////////////////////////////////////////////
+
+CsvReader::CsvReader(const char *filename)
+  : m_in(nullptr)
+  , m_filename(filename)
+  , m_delim(',')
+  , m_line(0)
+  , m_buf(nullptr)
+  , m_bufsize(0) {
+  m_in = fopen(filename, "r");
+  if (!m_in) {
+    RuntimeError::raise("Could not open input file '%s'", filename);
+  }
+
+  if (!read_line()) {
+    fclose(m_in);
+    free(m_buf);
+    RuntimeError::raise("%s: missing header line", filename);
+  }
+  if (strchr(m_buf, '\t') != nullptr) {
+    m_delim = '\t';
+  }
+
+  // split the header into column names
+  const char *p = m_buf;
+  for (;;) {
+    const char *field_end = strchr(p, m_delim);
+    if (field_end == nullptr) {
+      field_end = p + strlen(p);
+    }
+    std::string name(p, field_end);
+    if (!is_name(name)) {
+      fclose(m_in);
+      free(m_buf);
+      RuntimeError::raise("%s: column '%s' is not a valid variable name", filename, name.c_str());
+    }
+    if (std::find(m_columns.begin(), m_columns.end(), name) != m_columns.end()) {
+      fclose(m_in);
+      free(m_buf);
+      RuntimeError::raise("%s: duplicate column '%s'", filename, name.c_str());
+    }
+    m_columns.push_back(name);
+    if (*field_end == '\0') {
+      break;
+    }
+    p = field_end + 1;
+  }
+}
+
+CsvReader::~CsvReader() {
+  free(m_buf);
+  if (m_in) {
+    fclose(m_in);
+  }
+}
+
+bool CsvReader::read_row(long *values, unsigned char *present, std::string &error) {
+  if (!read_line()) {
+    return false;
+  }
+
+  error.clear();
+  char *p = m_buf;
+  for (unsigned i = 0; i < m_columns.size(); i++) {
+    // find the end of the field (which may be the end of the line)
+    char *field_end = p;
+    while (*field_end != '\0' && *field_end != m_delim) {
+      field_end++;
+    }
+    char next = *field_end;
+    *field_end = '\0';
+
+    present[i] = 0;
+    if (*p != '\0') {
+      char *num_end;
+      errno = 0;
+      long value = strtol(p, &num_end, 10);
+      if (*num_end != '\0' || errno != 0) {
+        if (error.empty()) {
+          error = "Invalid value '" + std::string(p) + "' for '" + m_columns[i] + "'";
+        }
+      } else {
+        values[i] = value;
+        present[i] = 1;
+      }
+    }
+
+    // a short row leaves the remaining columns without values
+    p = (next == '\0') ? field_end : field_end + 1;
+    if (next == '\0' && i + 1 < m_columns.size()) {
+      for (unsigned j = i + 1; j < m_columns.size(); j++) {
+        present[j] = 0;
+      }
+      break;
+    }
+  }
+
+  if (*p != '\0' && error.empty()) {
+    error = "Too many fields";
+  }
+
+  return true;
+}
+
+// Read the next line into m_buf, without the line terminator
+bool CsvReader::read_line() {
+  ssize_t len = getline(&m_buf, &m_bufsize, m_in);
+  if (len < 0) {
+    if (ferror(m_in)) {
+      RuntimeError::raise("Error reading %s: %s", m_filename.c_str(), strerror(errno));
+    }
+    return false;
+  }
+  while (len > 0 && (m_buf[len - 1] == '\n' || m_buf[len - 1] == '\r')) {
+    m_buf[--len] = '\0';
+  }
+  m_line++;
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "bytecode.h"
+#include "env.h"
+
+// Evaluates compiled code over a block of rows at once, where each
+// row is an independent execution of the code with its own variable
+// values.  Variable values are stored by column: the value of slot s
+// in row r is values[s * block_size + r], and it is defined if
+// defined[s * block_size + r] is nonzero.  Each instruction is
+// executed for every row of the block before moving on to the next
+// instruction, so the arithmetic is done on arrays of values, using
+// AVX2 instructions if the CPU supports them.
+//
+// An error in one row doesn't affect the other rows: the row's first
+// error (in evaluation order) is recorded, and the values computed
+// for the row after that point are meaningless.
+class BatchEvaluator {
+private:
+  enum { NO_ERROR = ~0u };
+
+  const Bytecode *m_code;
+  Environment *m_env;
+  unsigned m_block_size;
+  std::vector<long> m_stack;           // column of each stack entry
+  std::vector<long> m_result;          // per row
+  std::vector<unsigned> m_error_pc;    // per row: instruction which failed
+
+  // no value semantics
+  BatchEvaluator(const BatchEvaluator &);
+  BatchEvaluator &operator=(const BatchEvaluator &);
+
+public:
+  // The Environment is only used to find the number of slots and
+  // to raise errors
+  BatchEvaluator(const Bytecode *code, Environment *env);
+  ~BatchEvaluator();
+
+  // Maximum number of rows in a block.  This is reduced for code
+  // which needs a deep stack, to keep the size of the stack bounded.
+  unsigned get_block_size() const { return m_block_size; }
+
+  // Evaluate rows 0..num_rows-1 of a block
+  void eval(unsigned num_rows, long *values, unsigned char *defined);
+
+  bool is_error(unsigned row) const { return m_error_pc[row] != NO_ERROR; }
+  long get_result(unsigned row) const { return m_result[row]; }
+
+  // Raise the error of a row that failed, the same way as the
+  // other engines would have raised it
+  void raise_error(unsigned row) const
+#ifdef __GNUC__
+    __attribute__ ((noreturn))
+#endif
+    ;
+
+  // Name of the implementation of the arithmetic on blocks
+  static const char *get_impl_name();
+};
+
+// Reads rows of integer values from a file of delimiter-separated
+// values (CSV or TSV).  The first line is a header naming the column
+// of each field; the names must be distinct variable names.  The
+// delimiter is a tab if the header contains a tab, and a comma
+// otherwise.  An empty field means that the row has no value for that
+// column.
+class CsvReader {
+private:
+  FILE *m_in;
+  std::string m_filename;
+  char m_delim;
+  std::vector<std::string> m_columns;
+  unsigned long m_line;
+  char *m_buf;
+  size_t m_bufsize;
+
+  // no value semantics
+  CsvReader(const CsvReader &);
+  CsvReader &operator=(const CsvReader &);
+
+public:
+  CsvReader(const char *filename);
+  ~CsvReader();
+
+  char get_delim() const { return m_delim; }
+  unsigned get_num_columns() const { return unsigned(m_columns.size()); }
+  const std::string &get_column_name(unsigned i) const { return m_columns[i]; }
+
+  // Line number of the row most recently read
+  unsigned long get_line() const { return m_line; }
+
+  // Read the next row, storing the value of column i in values[i]
+  // and setting present[i] if the row has a value for it.
+  // Returns false at the end of the input.  If a field isn't a valid
+  // integer, or the row has too many fields, error is set to a
+  // description of the problem.
+  bool read_row(long *values, unsigned char *present, std::string &error);
+
+private:
+  bool read_line();
+};
+
+#endif // BATCH_H
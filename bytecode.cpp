@@ -0,0 +1,156 @@
+#include <cstdio>
+#include <cassert>
+#include "exceptions.h"
+#include "bytecode.h"
+
+////////////////////////////////////////////////////////////////////////
+// Bytecode implementation
+////////////////////////////////////////////////////////////////////////
+
+Bytecode::Bytecode()
+  : m_max_depth(0) {
+}
+
+Bytecode::~Bytecode() {
+}
+
+void Bytecode::compile(const FlatAst &ast) {
+  clear();
+
+  unsigned num_stmts = ast.get_num_statements();
+  for (unsigned i = 0; i < num_stmts; i++) {
+    if (i > 0) {
+      // discard the value of the previous statement
+      emit(OP_POP, 0, Location());
+    }
+    compile_expr(ast, ast.get_statement(i), ast.get_statement_end(i));
+  }
+  emit(OP_HALT, 0, Location());
+}
+
+void Bytecode::compile_statement(const FlatAst &ast, unsigned stmt) {
+  clear();
+  compile_expr(ast, ast.get_statement(stmt), ast.get_statement_end(stmt));
+  emit(OP_HALT, 0, Location());
+}
+
+void Bytecode::clear() {
+  m_code.clear();
+  m_locs.clear();
+  m_max_depth = 0;
+}
+
+// Compile the expression stored in AST nodes begin..end-1 to postfix
+// code.  This works the same way as Interpreter::eval, except that
+// code is emitted rather than values being computed: each leaf is
+// compiled when it is encountered, and then the operators and
+// assignments waiting for it (on the work stack, along with the
+// number of operands compiled so far) are completed.
+void Bytecode::compile_expr(const FlatAst &ast, unsigned begin, unsigned end) {
+  // the stack depth is 1 after each statement (its value)
+  unsigned depth = 0;
+
+  m_work.clear();
+  for (unsigned i = begin; i < end; i++) {
+    AstOp op = ast.get_op(i);
+
+    if (op == AST_LITERAL) {
+      emit(OP_PUSH, ast.get_payload(i), ast.get_loc(i));
+    } else if (op == AST_VAR) {
+      emit(OP_LOAD, ast.get_payload(i), ast.get_loc(i));
+    } else {
+      m_work.push_back({ i, 0 });
+      continue;
+    }
+
+    depth++;
+    if (depth > m_max_depth) {
+      m_max_depth = depth;
+    }
+
+    while (!m_work.empty()) {
+      unsigned node = m_work.back().first;
+      AstOp node_op = ast.get_op(node);
+
+      if (node_op == AST_ASSIGN) {
+        emit(OP_STORE, ast.get_payload(node), ast.get_loc(node));
+        m_work.pop_back();
+        continue;
+      }
+
+      if (m_work.back().second == 0) {
+        // left operand is done, right operand is next
+        m_work.back().second = 1;
+        break;
+      }
+
+      Opcode opcode;
+      switch (node_op) {
+      case AST_ADD: opcode = OP_ADD; break;
+      case AST_SUB: opcode = OP_SUB; break;
+      case AST_MUL: opcode = OP_MUL; break;
+      case AST_DIV: opcode = OP_DIV; break;
+      default:
+        RuntimeError::raise("Unknown AST op: %d", int(node_op));
+      }
+      emit(opcode, 0, ast.get_loc(node));
+      depth--;
+      m_work.pop_back();
+    }
+  }
+
+  assert(m_work.empty() && depth == 1);
+}
+
+void Bytecode::emit(Opcode op, long arg, const Location &loc) {
+  m_code.push_back({ (unsigned char) op, arg });
+  m_locs.push_back(loc);
+}
+
+void Bytecode::disassemble(const SymbolTable *symtab) const {
+  printf("; max stack depth %u\n", m_max_depth);
+
+  unsigned num_insns = get_num_insns();
+  for (unsigned pc = 0; pc < num_insns; pc++) {
+    const Insn &insn = m_code[pc];
+    Opcode op = Opcode(insn.op);
+    printf("%6u  ", pc);
+    if (op == OP_PUSH) {
+      printf("%-6s %ld", opcode_to_string(op), insn.arg);
+    } else if (op == OP_LOAD || op == OP_STORE) {
+      if (symtab != nullptr) {
+        printf("%-6s %s", opcode_to_string(op), symtab->get_name(unsigned(insn.arg)).c_str());
+      } else {
+        printf("%-6s slot %ld", opcode_to_string(op), insn.arg);
+      }
+    } else {
+      printf("%s", opcode_to_string(op));
+    }
+    printf("\n");
+  }
+}
+
+const char *Bytecode::opcode_to_string(Opcode op) {
+  switch (op) {
+  case OP_PUSH:
+    return "PUSH";
+  case OP_LOAD:
+    return "LOAD";
+  case OP_STORE:
+    return "STORE";
+  case OP_ADD:
+    return "ADD";
+  case OP_SUB:
+    return "SUB";
+  case OP_MUL:
+    return "MUL";
+  case OP_DIV:
+    return "DIV";
+  case OP_POP:
+    return "POP";
+  case OP_HALT:
+    return "HALT";
+  default:
+    RuntimeError::raise("Unknown opcode: %d", int(op));
+  }
+}
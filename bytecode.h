@@ -0,0 +1,70 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <vector>
+#include "location.h"
+#include "ast.h"
+#include "symtab.h"
+
+// Bytecode instructions for the stack VM.
+enum Opcode {
+  OP_PUSH,    // push arg (an integer constant)
+  OP_LOAD,    // push value of variable in slot arg
+  OP_STORE,   // store top of stack in slot arg (leaving it on the stack)
+  OP_ADD,     // pop right and left operands, push result
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_POP,     // discard top of stack
+  OP_HALT,    // stop, result is top of stack
+  NUM_OPCODES,
+};
+
+struct Insn {
+  unsigned char op;
+  long arg;
+};
+
+// A compiled sequence of bytecode instructions.  Code is compiled from
+// a FlatAst: the value of each statement is left on the stack and then
+// popped, except for the last statement, whose value is the result.
+class Bytecode {
+private:
+  std::vector<Insn> m_code;
+  std::vector<Location> m_locs;   // source location of each instruction
+  unsigned m_max_depth;           // maximum stack depth
+
+  // stack used while compiling
+  std::vector<std::pair<unsigned, int>> m_work;
+
+  // no value semantics
+  Bytecode(const Bytecode &);
+  Bytecode &operator=(const Bytecode &);
+
+public:
+  Bytecode();
+  ~Bytecode();
+
+  // Compile all of the statements in an AST, replacing any existing code
+  void compile(const FlatAst &ast);
+
+  // Compile a single statement, replacing any existing code
+  void compile_statement(const FlatAst &ast, unsigned stmt);
+
+  unsigned get_num_insns() const { return unsigned(m_code.size()); }
+  const Insn *get_code() const { return m_code.data(); }
+  const Location &get_loc(unsigned pc) const { return m_locs[pc]; }
+  unsigned get_max_depth() const { return m_max_depth; }
+
+  // Print a listing of the code
+  void disassemble(const SymbolTable *symtab) const;
+
+  static const char *opcode_to_string(Opcode op);
+
+private:
+  void clear();
+  void compile_expr(const FlatAst &ast, unsigned begin, unsigned end);
+  void emit(Opcode op, long arg, const Location &loc);
+};
+
+#endif // BYTECODE_H
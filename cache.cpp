@@ -0,0 +1,476 @@
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include "srcmgr.h"
+#include "cache.h"
+
+namespace {
+
+// Version of the cache file format.  This must be changed whenever
+// the format changes, so that cache files written by an older version
+// of the program aren't used (they will simply never be found, since
+// the version is part of the hash which names the file).  Changes to
+// the AST produced for a given source don't need a new version, since
+// the build of the program is also part of the hash (see build_hash).
+const uint32_t FORMAT_VERSION = 2;
+const char MAGIC[8] = { 'P', 'F', 'X', 'C', 'A', 'C', 'H', 'E' };
+const uint32_t ORDER_CHECK = 0x01020304;
+
+// The file is a Header followed by the arrays:
+//   long payloads[num_nodes]
+//   uint64_t offsets[num_nodes]     source offset of each node
+//   unsigned right[num_nodes]
+//   unsigned stmts[num_stmts]
+//   unsigned name_lens[num_symbols]
+//   unsigned char ops[num_nodes]
+//   char names[names_size]          variable names, not terminated
+// in order of decreasing alignment, so no padding is needed.
+// Variable slots in the payloads are indexes into the names.
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t long_size;
+  uint32_t num_nodes;
+  uint32_t num_stmts;
+  uint32_t num_symbols;
+  uint64_t names_size;
+  uint64_t build_hash;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t checksum;       // hash of everything following the header
+};
+
+// Offsets of the arrays in a cache file
+struct Layout {
+  size_t payloads, offsets, right, stmts, name_lens, ops, names, end;
+
+  explicit Layout(const Header &h) {
+    uint64_t n = h.num_nodes;
+    payloads = sizeof(Header);
+    offsets = payloads + n * sizeof(long);
+    right = offsets + n * sizeof(uint64_t);
+    stmts = right + n * sizeof(unsigned);
+    name_lens = stmts + uint64_t(h.num_stmts) * sizeof(unsigned);
+    ops = name_lens + uint64_t(h.num_symbols) * sizeof(unsigned);
+    names = ops + n;
+    end = names + h.names_size;
+  }
+};
+
+// A fast (non-cryptographic) hash, used both to name cache files
+// and to detect corruption.  The input is consumed 8 bytes at a time.
+uint64_t hash_bytes(const char *p, size_t n, uint64_t h) {
+  const uint64_t MULT = 0x9e3779b97f4a7c15ULL;
+  h ^= uint64_t(n) * MULT;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = (h ^ w) * MULT;
+    h ^= h >> 29;
+  }
+  uint64_t w = 0;
+  memcpy(&w, p, n);
+  h = (h ^ w) * MULT;
+  h ^= h >> 32;
+  h *= MULT;
+  h ^= h >> 29;
+  return h;
+}
+
+// Find the GNU build id note of the loaded object containing
+// the address passed as data
+int find_build_id(struct dl_phdr_info *info, size_t, void *data) {
+  std::pair<uintptr_t, std::string> &search = *static_cast<std::pair<uintptr_t, std::string> *>(data);
+  bool contains = false;
+  for (unsigned i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+    uintptr_t start = info->dlpi_addr + ph.p_vaddr;
+    contains = contains || (ph.p_type == PT_LOAD && search.first >= start && search.first < start + ph.p_memsz);
+  }
+  if (!contains) {
+    return 0;
+  }
+
+  for (unsigned i = 0; i < info->dlpi_phnum; i++) {
+    const ElfW(Phdr) &ph = info->dlpi_phdr[i];
+    if (ph.p_type != PT_NOTE) {
+      continue;
+    }
+    const char *p = reinterpret_cast<const char *>(info->dlpi_addr + ph.p_vaddr);
+    const char *end = p + ph.p_memsz;
+    while (p + sizeof(ElfW(Nhdr)) <= end) {
+      ElfW(Nhdr) nh;
+      memcpy(&nh, p, sizeof(nh));
+      const char *name = p + sizeof(nh);
+      const char *desc = name + ((nh.n_namesz + 3) & ~3u);
+      if (nh.n_type == NT_GNU_BUILD_ID && nh.n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+        search.second.assign(desc, nh.n_descsz);
+        return 1;
+      }
+      p = desc + ((nh.n_descsz + 3) & ~3u);
+    }
+  }
+  return 1;
+}
+
+// Hash identifying the build of the program, so that a cache file
+// written by a build which might have parsed the source differently
+// isn't used.  This is the linker's build id, which changes whenever
+// the program's code does, or, if there isn't one, the time this file
+// was compiled.
+uint64_t build_hash() {
+  static const uint64_t hash = []() {
+    std::pair<uintptr_t, std::string> search(reinterpret_cast<uintptr_t>(&find_build_id), "");
+    dl_iterate_phdr(find_build_id, &search);
+    if (search.second.empty()) {
+      search.second = "compiled " __DATE__ " " __TIME__;
+    }
+    return hash_bytes(search.second.data(), search.second.size(), 0);
+  }();
+  return hash;
+}
+
+// Hash of a source, which is also the key of its cache file
+uint64_t hash_source(const char *p, size_t n) {
+  static const char VERSION_KEY[] = "pfxcalc program cache";
+  uint64_t h = hash_bytes(VERSION_KEY, sizeof(VERSION_KEY) - 1, FORMAT_VERSION);
+  uint64_t build = build_hash();
+  h = hash_bytes(reinterpret_cast<const char *>(&build), sizeof(build), h);
+  return hash_bytes(p, n, h);
+}
+
+// Check that the contents of a cache file are consistent, so that
+// the AST can be used without further checks.  Returns a description
+// of the problem, or nullptr if the file is valid.
+const char *validate(const char *data, size_t size, uint64_t source_hash, size_t source_size) {
+  if (size < sizeof(Header)) {
+    return "truncated";
+  }
+  Header h;
+  memcpy(&h, data, sizeof(Header));
+  if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != FORMAT_VERSION ||
+      h.byte_order != ORDER_CHECK || h.long_size != sizeof(long)) {
+    return "wrong format";
+  }
+  if (h.build_hash != build_hash()) {
+    return "different build";
+  }
+  if (h.source_hash != source_hash || h.source_size != source_size) {
+    return "different source";
+  }
+  if (h.names_size > size || Layout(h).end != size) {
+    return "wrong size";
+  }
+  if (hash_bytes(data + sizeof(Header), size - sizeof(Header), 0) != h.checksum) {
+    return "bad checksum";
+  }
+
+  // the arrays are accessed through a private mapping, so they are
+  // suitably aligned
+  Layout layout(h);
+  unsigned num_nodes = h.num_nodes, num_stmts = h.num_stmts;
+  const long *payloads = reinterpret_cast<const long *>(data + layout.payloads);
+  const uint64_t *offsets = reinterpret_cast<const uint64_t *>(data + layout.offsets);
+  const unsigned *right = reinterpret_cast<const unsigned *>(data + layout.right);
+  const unsigned *stmts = reinterpret_cast<const unsigned *>(data + layout.stmts);
+  const unsigned *name_lens = reinterpret_cast<const unsigned *>(data + layout.name_lens);
+  const unsigned char *ops = reinterpret_cast<const unsigned char *>(data + layout.ops);
+
+  uint64_t names_size = 0;
+  for (unsigned i = 0; i < h.num_symbols; i++) {
+    if (name_lens[i] == 0) {
+      return "bad variable name";
+    }
+    names_size += name_lens[i];
+  }
+  if (names_size != h.names_size) {
+    return "bad variable name";
+  }
+
+  if ((num_nodes == 0) != (num_stmts == 0) || (num_stmts > 0 && stmts[0] != 0)) {
+    return "bad statement";
+  }
+  for (unsigned i = 1; i < num_stmts; i++) {
+    if (stmts[i] <= stmts[i - 1] || stmts[i] >= num_nodes) {
+      return "bad statement";
+    }
+  }
+
+  // Each statement must be exactly one tree in preorder.  Working
+  // backwards, find the end of each node's subtree, which checks
+  // that its operands are within the statement and that the right
+  // operand of a binary operator follows the left operand's subtree.
+  std::vector<unsigned> ends(num_nodes);
+  for (unsigned s = num_stmts; s-- > 0; ) {
+    unsigned begin = stmts[s];
+    unsigned end = s + 1 < num_stmts ? stmts[s + 1] : num_nodes;
+    for (unsigned i = end; i-- > begin; ) {
+      AstOp op = AstOp(ops[i]);
+      if (op > AST_DIV || offsets[i] >= source_size) {
+        return "bad node";
+      }
+      if (op == AST_LITERAL || op == AST_VAR) {
+        if (op == AST_VAR && (payloads[i] < 0 || payloads[i] >= long(h.num_symbols))) {
+          return "bad variable";
+        }
+        ends[i] = i + 1;
+      } else if (i + 1 >= end) {
+        return "missing operand";
+      } else if (op == AST_ASSIGN) {
+        if (payloads[i] < 0 || payloads[i] >= long(h.num_symbols)) {
+          return "bad variable";
+        }
+        ends[i] = ends[i + 1];
+      } else {
+        if (right[i] != ends[i + 1] || right[i] >= end) {
+          return "bad operand";
+        }
+        ends[i] = ends[right[i]];
+      }
+    }
+    if (ends[begin] != end) {
+      return "bad statement";
+    }
+  }
+
+  return nullptr;
+}
+
+// Compute the offsets of the starts of the lines of a source after
+// the first, the same way the lexer records them
+void find_line_starts(const char *p, size_t size, std::vector<unsigned long> &line_starts) {
+  const char *begin = p, *end = p + size;
+  while ((p = static_cast<const char *>(memchr(p, '\n', size_t(end - p)))) != nullptr) {
+    p++;
+    line_starts.push_back((unsigned long) (p - begin));
+  }
+}
+
+bool write_all(int fd, const void *buf, size_t n) {
+  const char *p = static_cast<const char *>(buf);
+  while (n > 0) {
+    ssize_t written = write(fd, p, n);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += written;
+    n -= size_t(written);
+  }
+  return true;
+}
+
+} // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////
+// ProgramCache implementation
+////////////////////////////////////////////////////////////////////////
+
+ProgramCache::ProgramCache(const std::string &dir)
+  : m_dir(dir)
+  , m_map(nullptr)
+  , m_size(0)
+  , m_hash(0) {
+}
+
+ProgramCache::~ProgramCache() {
+  if (m_map != nullptr) {
+    munmap(m_map, m_size);
+  }
+}
+
+bool ProgramCache::load(FILE *in, const char *filename, SymbolTable &symtab, FlatAst &ast) {
+  // the source must be hashed to find its cache file, so it has to
+  // be a file that can be mapped (rather than, e.g., a pipe)
+  struct stat st;
+  int fd = fileno(in);
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    m_status = "not used (input is not a file)";
+    return false;
+  }
+  m_size = size_t(st.st_size);
+  m_map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (m_map == MAP_FAILED) {
+    m_map = nullptr;
+    m_status = "not used (input could not be mapped)";
+    return false;
+  }
+  const char *source = static_cast<const char *>(m_map);
+  m_hash = hash_source(source, m_size);
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.pfxc", (unsigned long long) m_hash);
+  m_path = m_dir + name;
+
+  int cache_fd = open(m_path.c_str(), O_RDONLY);
+  if (cache_fd < 0) {
+    m_status = "miss";
+    return false;
+  }
+  const char *problem = "truncated";
+  void *map = MAP_FAILED;
+  size_t size = 0;
+  if (fstat(cache_fd, &st) == 0 && st.st_size > 0) {
+    size = size_t(st.st_size);
+    map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, cache_fd, 0);
+  }
+  close(cache_fd);
+  if (map != MAP_FAILED) {
+    problem = validate(static_cast<const char *>(map), size, m_hash, m_size);
+  }
+  if (problem != nullptr) {
+    if (map != MAP_FAILED) {
+      munmap(map, size);
+    }
+    m_status = std::string("invalid cache file (") + problem + ")";
+    return false;
+  }
+
+  const char *data = static_cast<const char *>(map);
+  Header h;
+  memcpy(&h, data, sizeof(Header));
+  Layout layout(h);
+
+  // Intern the variable names.  Unless some names were already in
+  // the symbol table, the slots will be the same as in the cached
+  // program, and its payloads can be used as they are.
+  std::vector<unsigned> slots(h.num_symbols);
+  const unsigned *name_lens = reinterpret_cast<const unsigned *>(data + layout.name_lens);
+  const char *names = data + layout.names;
+  bool same_slots = true;
+  for (unsigned i = 0; i < h.num_symbols; i++) {
+    slots[i] = symtab.intern(names, name_lens[i]);
+    same_slots = same_slots && slots[i] == i;
+    names += name_lens[i];
+  }
+  const unsigned char *ops = reinterpret_cast<const unsigned char *>(data + layout.ops);
+  const long *payloads = reinterpret_cast<const long *>(data + layout.payloads);
+  std::vector<long> remapped;
+  if (!same_slots) {
+    remapped.assign(payloads, payloads + h.num_nodes);
+    for (unsigned i = 0; i < h.num_nodes; i++) {
+      if (ops[i] == AST_VAR || ops[i] == AST_ASSIGN) {
+        remapped[i] = slots[remapped[i]];
+      }
+    }
+    payloads = remapped.data();
+  }
+
+  // the nodes' locations are in a new source, whose line starts
+  // are found from the source text
+  SourceManager &srcmgr = SourceManager::get_instance();
+  unsigned src = srcmgr.add_source(filename);
+  std::vector<unsigned long> line_starts;
+  find_line_starts(source, m_size, line_starts);
+  srcmgr.add_line_starts(src, line_starts);
+
+  ast.load(h.num_nodes, ops, reinterpret_cast<const unsigned *>(data + layout.right),
+           payloads, src, reinterpret_cast<const uint64_t *>(data + layout.offsets),
+           h.num_stmts, reinterpret_cast<const unsigned *>(data + layout.stmts));
+  munmap(map, size);
+
+  m_status = "hit";
+  return true;
+}
+
+void ProgramCache::store(const FlatAst &ast, const SymbolTable &symtab) {
+  if (m_path.empty()) {
+    return;
+  }
+
+  // number the variables in order of first use, which (if the
+  // symbol table was empty) is the order they were interned in
+  unsigned num_nodes = ast.get_num_nodes(), num_stmts = ast.get_num_statements();
+  std::vector<int> symbols(symtab.get_num_symbols(), -1);
+  std::vector<unsigned> name_lens;
+  std::string names;
+  std::vector<long> payloads(ast.get_payloads(), ast.get_payloads() + num_nodes);
+  std::vector<uint64_t> offsets(num_nodes);
+  for (unsigned i = 0; i < num_nodes; i++) {
+    AstOp op = ast.get_op(i);
+    if (op == AST_VAR || op == AST_ASSIGN) {
+      int &symbol = symbols[payloads[i]];
+      if (symbol < 0) {
+        const std::string &name = symtab.get_name(unsigned(payloads[i]));
+        symbol = int(name_lens.size());
+        name_lens.push_back(unsigned(name.size()));
+        names += name;
+      }
+      payloads[i] = symbol;
+    }
+    offsets[i] = ast.get_loc(i).get_offset();
+  }
+  std::vector<unsigned> stmts(num_stmts);
+  for (unsigned i = 0; i < num_stmts; i++) {
+    stmts[i] = ast.get_statement(i);
+  }
+
+  Header h;
+  memset(&h, 0, sizeof(Header));
+  memcpy(h.magic, MAGIC, sizeof(MAGIC));
+  h.version = FORMAT_VERSION;
+  h.byte_order = ORDER_CHECK;
+  h.long_size = sizeof(long);
+  h.num_nodes = num_nodes;
+  h.num_stmts = num_stmts;
+  h.num_symbols = unsigned(name_lens.size());
+  h.names_size = names.size();
+  h.build_hash = build_hash();
+  h.source_hash = m_hash;
+  h.source_size = m_size;
+
+  struct Array {
+    const void *data;
+    size_t size;
+  };
+  const Array arrays[] = {
+    { payloads.data(), num_nodes * sizeof(long) },
+    { offsets.data(), num_nodes * sizeof(uint64_t) },
+    { ast.get_rights(), num_nodes * sizeof(unsigned) },
+    { stmts.data(), num_stmts * sizeof(unsigned) },
+    { name_lens.data(), name_lens.size() * sizeof(unsigned) },
+    { ast.get_ops(), num_nodes },
+    { names.data(), names.size() },
+  };
+  const unsigned NUM_ARRAYS = unsigned(sizeof(arrays) / sizeof(arrays[0]));
+
+  // the checksum is computed over the arrays as they will appear
+  // in the file
+  std::vector<char> body;
+  for (unsigned i = 0; i < NUM_ARRAYS; i++) {
+    const char *p = static_cast<const char *>(arrays[i].data);
+    body.insert(body.end(), p, p + arrays[i].size);
+  }
+  h.checksum = hash_bytes(body.data(), body.size(), 0);
+
+  // Write a temporary file and rename it, so that another process
+  // never sees a partially written cache file
+  std::string tmp_path = m_path + ".tmp" + std::to_string(getpid());
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    m_status += std::string(", not stored (") + strerror(errno) + ")";
+    return;
+  }
+  bool ok = write_all(fd, &h, sizeof(Header)) && write_all(fd, body.data(), body.size());
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+    m_status += std::string(", not stored (") + strerror(errno) + ")";
+    unlink(tmp_path.c_str());
+    return;
+  }
+  m_status += ", stored";
+}
+
+void ProgramCache::print_stats(FILE *out) const {
+  fprintf(out, "cache: %s%s%s\n", m_status.c_str(), m_path.empty() ? "" : " ", m_path.c_str());
+}
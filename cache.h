@@ -0,0 +1,57 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include "ast.h"
+#include "symtab.h"
+
+// A ProgramCache saves the flat AST of a parsed program in a directory
+// of cache files, so that a later run on the same source can load the
+// AST directly rather than lexing and parsing the source again.  A
+// cache file is named by a hash of the source text, the cache format
+// version, and the build of the program (so a rebuilt program which
+// parses differently doesn't use old files), and contains the AST's arrays in native format
+// (so it can be mapped into memory and copied), the names of the
+// variables it refers to, and the source offset of each node.  The
+// line structure of the source is recomputed from the source text,
+// so Locations in a loaded AST work the same as if it had been parsed.
+//
+// Every cache file is validated before it is used (checksum, sizes,
+// and the structure of each statement's tree), and a file which
+// doesn't match the source or is corrupt is treated as a miss, which
+// is then replaced by storing the parsed program.
+class ProgramCache {
+private:
+  std::string m_dir;
+  std::string m_path;      // cache file for the current source
+  void *m_map;             // mapping of the current source
+  size_t m_size;
+  uint64_t m_hash;         // hash of the current source
+  std::string m_status;    // what happened, for print_stats
+
+  // no value semantics
+  ProgramCache(const ProgramCache &);
+  ProgramCache &operator=(const ProgramCache &);
+
+public:
+  ProgramCache(const std::string &dir);
+  ~ProgramCache();
+
+  // Try to load the program read from given input file (which is
+  // not read from) from the cache.  On success, the variables are
+  // interned in symtab and the program is stored in ast.  Returns
+  // false if there is no valid cache file for the source, in which
+  // case the source should be parsed and the result passed to store.
+  bool load(FILE *in, const char *filename, SymbolTable &symtab, FlatAst &ast);
+
+  // Save the program parsed from the source passed to load.  The
+  // cache is only an optimization, so failing to write the cache
+  // file isn't an error.
+  void store(const FlatAst &ast, const SymbolTable &symtab);
+
+  void print_stats(FILE *out) const;
+};
+
+#endif // CACHE_H
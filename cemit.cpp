@@ -0,0 +1,229 @@
+#include <climits>
+#include <cctype>
+#include <vector>
+#include "cpputil.h"
+#include "exceptions.h"
+#include "cemit.h"
+
+////////////////////////////////////////////////////////////////////////
+// CEmitter implementation
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Support code included in every generated translation unit.
+// Arithmetic wraps around, as in arith.h.  (The first argument is the
+// upper case symbol prefix.)
+const char *s_prologue =
+  "#include <stdlib.h>\n"
+  "\n"
+  "#define %s_NUM_VARS %u\n"
+  "\n"
+  "static inline long pfx_add(long a, long b) { return (long) ((unsigned long) a + (unsigned long) b); }\n"
+  "static inline long pfx_sub(long a, long b) { return (long) ((unsigned long) a - (unsigned long) b); }\n"
+  "static inline long pfx_mul(long a, long b) { return (long) ((unsigned long) a * (unsigned long) b); }\n"
+  "static inline long pfx_div(long a, long b) { return b == -1 ? (long) (0UL - (unsigned long) a) : a / b; }\n"
+  "\n";
+
+// (The arguments are the upper case prefix, three times, and then
+// the prefix, twice.)
+const char *s_main =
+  "#ifdef %s_MAIN\n"
+  "#include <stdio.h>\n"
+  "\n"
+  "int main(void)\n"
+  "{\n"
+  "  static long vars[%s_NUM_VARS + 1];\n"
+  "  static unsigned char defined[%s_NUM_VARS + 1];\n"
+  "  int error;\n"
+  "  long result = %s_eval(vars, defined, &error);\n"
+  "  if (error != 0) {\n"
+  "    fprintf(stderr, \"%%s\\n\", %s_error_message(error));\n"
+  "    return 1;\n"
+  "  }\n"
+  "  printf(\"Result: %%ld\\n\", result);\n"
+  "  return 0;\n"
+  "}\n"
+  "#endif\n";
+
+}
+
+CEmitter::CEmitter(const SymbolTable *symtab, FILE *out)
+  : m_symtab(symtab)
+  , m_out(out)
+  , m_prefix("pfxcalc") {
+}
+
+CEmitter::~CEmitter() {
+}
+
+void CEmitter::set_prefix(const std::string &prefix) {
+  bool valid = !prefix.empty() && !isdigit((unsigned char) prefix[0]);
+  for (auto i = prefix.begin(); i != prefix.end(); ++i) {
+    valid = valid && (isalnum((unsigned char) *i) || *i == '_');
+  }
+  if (!valid) {
+    RuntimeError::raise("Invalid symbol prefix: %s", prefix.c_str());
+  }
+  m_prefix = prefix;
+}
+
+// The bytecode is translated one instruction at a time, with the VM
+// stack becoming an array of locals (which the C compiler can keep in
+// registers, since every index is a constant).  Since the code is
+// straight-line, a variable which has been assigned by an earlier
+// instruction is known to be defined, so only loads of variables
+// which might not have been assigned yet need to be checked.
+void CEmitter::emit(const Bytecode &code) {
+  unsigned num_vars = m_symtab->get_num_symbols();
+  const Insn *insns = code.get_code();
+  unsigned num_insns = code.get_num_insns();
+
+  const char *prefix = m_prefix.c_str();
+  std::string upper_prefix;
+  for (auto i = m_prefix.begin(); i != m_prefix.end(); ++i) {
+    upper_prefix += char(toupper((unsigned char) *i));
+  }
+  const char *upper = upper_prefix.c_str();
+
+  fprintf(m_out, "/* Generated by pfxcalc */\n\n");
+  fprintf(m_out, s_prologue, upper, num_vars);
+
+  fprintf(m_out, "const char *const %s_var_names[%s_NUM_VARS + 1] = {\n", prefix, upper);
+  for (unsigned i = 0; i < num_vars; i++) {
+    fprintf(m_out, "  %s,\n", c_string(m_symtab->get_name(i)).c_str());
+  }
+  fprintf(m_out, "  0\n};\n\n");
+
+  // Error messages: element i is the message for error code i
+  std::vector<std::string> errors;
+  errors.push_back("");
+
+  std::vector<bool> assigned(num_vars, false);
+  unsigned depth = 0;
+  std::string body;
+
+  for (unsigned pc = 0; pc < num_insns; pc++) {
+    const Insn &insn = insns[pc];
+    const Location &loc = code.get_loc(pc);
+    unsigned slot = unsigned(insn.arg);
+
+    switch (insn.op) {
+    case OP_PUSH:
+      // -9223372036854775808L would negate a constant too large for long
+      if (insn.arg == LONG_MIN) {
+        body += cpputil::format("  s[%u] = (-%ldL - 1);\n", depth++, LONG_MAX);
+      } else {
+        body += cpputil::format("  s[%u] = %ldL;\n", depth++, insn.arg);
+      }
+      break;
+
+    case OP_LOAD:
+      if (!assigned[slot]) {
+        errors.push_back(cpputil::format("%s:%d: Error: Undefined variable '%s'",
+                                         loc.get_srcfile().c_str(), loc.get_line(),
+                                         m_symtab->get_name(slot).c_str()));
+        body += cpputil::format("  if (!defined[%u]) { *error = %u; return 0; }\n",
+                                slot, unsigned(errors.size() - 1));
+      }
+      body += cpputil::format("  s[%u] = vars[%u];\n", depth++, slot);
+      break;
+
+    case OP_STORE:
+      body += cpputil::format("  vars[%u] = s[%u]; defined[%u] = 1; /* %s */\n",
+                              slot, depth - 1, slot, m_symtab->get_name(slot).c_str());
+      assigned[slot] = true;
+      break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV: {
+      const char *fn = (insn.op == OP_ADD) ? "pfx_add"
+                     : (insn.op == OP_SUB) ? "pfx_sub"
+                     : (insn.op == OP_MUL) ? "pfx_mul"
+                     : "pfx_div";
+      if (insn.op == OP_DIV) {
+        errors.push_back(cpputil::format("%s:%d: Error: Division by zero",
+                                         loc.get_srcfile().c_str(), loc.get_line()));
+        body += cpputil::format("  if (s[%u] == 0) { *error = %u; return 0; }\n",
+                                depth - 1, unsigned(errors.size() - 1));
+      }
+      body += cpputil::format("  s[%u] = %s(s[%u], s[%u]);\n", depth - 2, fn, depth - 2, depth - 1);
+      depth--;
+      break;
+    }
+
+    case OP_POP:
+      depth--;
+      break;
+
+    case OP_HALT:
+      body += cpputil::format("  *error = 0;\n  return s[%u];\n", depth - 1);
+      break;
+
+    default:
+      RuntimeError::raise("Unknown opcode: %d", int(insn.op));
+    }
+  }
+
+  // a very deep stack would overflow the C stack, so it is allocated
+  // on the heap (by the caller of the function evaluating the program)
+  unsigned max_depth = code.get_max_depth() > 0 ? code.get_max_depth() : 1;
+  bool heap_stack = (max_depth > MAX_LOCAL_DEPTH);
+  if (heap_stack) {
+    errors.push_back("Error: Out of memory");
+  }
+
+  fprintf(m_out, "static const char *const %s_errors[%u] = {\n", prefix, unsigned(errors.size()));
+  fprintf(m_out, "  0,\n");
+  for (unsigned i = 1; i < errors.size(); i++) {
+    fprintf(m_out, "  %s,\n", c_string(errors[i]).c_str());
+  }
+  fprintf(m_out, "};\n\n");
+
+  fprintf(m_out, "const char *%s_error_message(int error)\n{\n", prefix);
+  fprintf(m_out, "  return (error > 0 && error < %u) ? %s_errors[error] : \"Unknown error\";\n}\n\n",
+          unsigned(errors.size()), prefix);
+
+  if (heap_stack) {
+    fprintf(m_out, "static long %s_eval_stack(long *vars, unsigned char *defined, int *error, long *s)\n{\n",
+            prefix);
+  } else {
+    fprintf(m_out, "long %s_eval(long *vars, unsigned char *defined, int *error)\n{\n", prefix);
+    fprintf(m_out, "  long s[%u];\n", max_depth);
+  }
+  // a program with no variables doesn't use vars or defined: this
+  // avoids unused parameter warnings when compiling with -Wextra
+  fprintf(m_out, "  (void) vars;\n  (void) defined;\n");
+  fputs(body.c_str(), m_out);
+  fprintf(m_out, "}\n\n");
+
+  if (heap_stack) {
+    fprintf(m_out, "long %s_eval(long *vars, unsigned char *defined, int *error)\n{\n", prefix);
+    fprintf(m_out, "  long result, *s = (long *) malloc(%u * sizeof(long));\n", max_depth);
+    fprintf(m_out, "  if (s == 0) { *error = %u; return 0; }\n", unsigned(errors.size() - 1));
+    fprintf(m_out, "  result = %s_eval_stack(vars, defined, error, s);\n", prefix);
+    fprintf(m_out, "  free(s);\n  return result;\n}\n\n");
+  }
+
+  fprintf(m_out, s_main, upper, upper, upper, prefix, prefix);
+}
+
+// Quote a string as a C string literal
+std::string CEmitter::c_string(const std::string &s) {
+  std::string result = "\"";
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    unsigned char c = (unsigned char) *i;
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += char(c);
+    } else if (c < 0x20 || c >= 0x7F) {
+      result += cpputil::format("\\%03o", c);
+    } else {
+      result += char(c);
+    }
+  }
+  result += "\"";
+  return result;
+}
@@ -0,0 +1,56 @@
+#ifndef CEMIT_H
+#define CEMIT_H
+
+#include <cstdio>
+#include <string>
+#include "bytecode.h"
+#include "symtab.h"
+
+// Emits a self-contained C translation unit which evaluates a compiled
+// program, so that it can be compiled ahead of time with the system
+// C compiler.  The generated code defines
+//
+//   long pfxcalc_eval(long *vars, unsigned char *defined, int *error);
+//   const char *pfxcalc_error_message(int error);
+//   const char *const pfxcalc_var_names[];
+//
+// along with the PFXCALC_NUM_VARS macro.  Variables are stored in
+// arrays indexed by slot, and errors (undefined variables and division
+// by zero) are reported through *error, with the same messages the
+// interpreter would produce.  Defining PFXCALC_MAIN when compiling
+// the generated code adds a main function which runs the program.
+//
+// The "pfxcalc" prefix of these names can be changed (see set_prefix),
+// so that several generated programs can be linked together.
+// pfxcalc_eval is reentrant: if the program is too deep for its stack
+// to be a local array, it is allocated with malloc for each call
+// (and if that fails, the error is "Out of memory").
+class CEmitter {
+private:
+  const SymbolTable *m_symtab;
+  FILE *m_out;
+  std::string m_prefix;
+
+  // no value semantics
+  CEmitter(const CEmitter &);
+  CEmitter &operator=(const CEmitter &);
+
+public:
+  // maximum stack depth for which the stack is a local array
+  enum { MAX_LOCAL_DEPTH = 4096 };
+
+  CEmitter(const SymbolTable *symtab, FILE *out = stdout);
+  ~CEmitter();
+
+  // Set the prefix of the names the generated code defines (the
+  // prefix of the macro names is the prefix in upper case).  It must
+  // be a C identifier.
+  void set_prefix(const std::string &prefix);
+
+  void emit(const Bytecode &code);
+
+private:
+  static std::string c_string(const std::string &s);
+};
+
+#endif // CEMIT_H
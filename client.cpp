@@ -0,0 +1,77 @@
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "exceptions.h"
+#include "client.h"
+
+////////////////////////////////////////////////////////////////////////
+// Client implementation
+////////////////////////////////////////////////////////////////////////
+
+Client::Client(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    RuntimeError::raise("Socket path '%s' is too long", path);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  m_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (m_fd < 0 || connect(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0) {
+    std::string err = strerror(errno);
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+    RuntimeError::raise("Could not connect to '%s': %s", path, err.c_str());
+  }
+}
+
+Client::~Client() {
+  close(m_fd);
+}
+
+std::string Client::request(const std::string &line, const std::string &text) {
+  std::string data = line + "\n" + text;
+  size_t pos = 0;
+  while (pos < data.size()) {
+    ssize_t n = send(m_fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      RuntimeError::raise("Error sending request: %s", strerror(errno));
+    }
+    pos += size_t(n);
+  }
+
+  size_t nl;
+  while ((nl = m_buf.find('\n')) == std::string::npos) {
+    char buf[4096];
+    ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      RuntimeError::raise("Error receiving response: %s", strerror(errno));
+    }
+    if (n == 0) {
+      RuntimeError::raise("Server closed the connection");
+    }
+    m_buf.append(buf, size_t(n));
+  }
+
+  std::string response = m_buf.substr(0, nl);
+  m_buf.erase(0, nl + 1);
+  return response;
+}
+
+std::string Client::eval(const std::string &program, const std::vector<std::string> &bindings) {
+  std::string line = "EVAL " + std::to_string(program.size());
+  for (auto i = bindings.begin(); i != bindings.end(); ++i) {
+    line += " " + *i;
+  }
+  return request(line, program);
+}
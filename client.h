@@ -0,0 +1,31 @@
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include <string>
+#include <vector>
+
+// Connection to a pfxcalc server (see server.h for the protocol)
+class Client {
+private:
+  int m_fd;
+  std::string m_buf;    // data received but not yet returned
+
+  // no value semantics
+  Client(const Client &);
+  Client &operator=(const Client &);
+
+public:
+  // Connect to the server listening on the socket at given path
+  Client(const char *path);
+  ~Client();
+
+  // Send a request and return the response (without the newline).
+  // text is sent after the request line, for an EVAL request.
+  std::string request(const std::string &line, const std::string &text = "");
+
+  // Evaluate a program, after binding the given variables
+  // (each is name=value)
+  std::string eval(const std::string &program, const std::vector<std::string> &bindings);
+};
+
+#endif // CLIENT_H
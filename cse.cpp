@@ -0,0 +1,198 @@
+#include <cassert>
+#include "cpputil.h"
+#include "cse.h"
+
+////////////////////////////////////////////////////////////////////////
+// CommonSubexprEliminator implementation
+////////////////////////////////////////////////////////////////////////
+
+CommonSubexprEliminator::CommonSubexprEliminator(SymbolTable *symtab)
+  : m_symtab(symtab)
+  , m_num_vns(0)
+  , m_nodes_before(0)
+  , m_nodes_after(0)
+  , m_num_distinct(0)
+  , m_num_temps(0)
+  , m_num_reuses(0) {
+}
+
+CommonSubexprEliminator::~CommonSubexprEliminator() {
+}
+
+void CommonSubexprEliminator::eliminate(const FlatAst &in, FlatAst &out) {
+  unsigned num_nodes = out.get_num_nodes();
+
+  number(in);
+  find_reuses(in);
+  emit(in, out);
+
+  m_nodes_before += in.get_num_nodes();
+  m_nodes_after += out.get_num_nodes() - num_nodes;
+  m_num_distinct += m_num_vns;
+}
+
+void CommonSubexprEliminator::print_stats(FILE *out) const {
+  fprintf(out, "cse: %lu nodes before, %lu after; %lu distinct subexpressions\n",
+          m_nodes_before, m_nodes_after, m_num_distinct);
+  fprintf(out, "cse: %lu subexpressions reused %lu times, saving %ld node evaluations\n",
+          m_num_temps, m_num_reuses, long(m_nodes_before) - long(m_nodes_after));
+}
+
+// Assign a value number to every node.  The nodes are visited in
+// evaluation order (as in Interpreter::eval), so that each variable
+// reference sees the number of assignments to the variable which
+// precede it.  The end of each node's subtree is recorded as well.
+void CommonSubexprEliminator::number(const FlatAst &in) {
+  unsigned num_nodes = in.get_num_nodes();
+
+  m_table.clear();
+  m_num_vns = 0;
+  m_version.assign(m_symtab->get_num_symbols(), 0);
+  m_vn.resize(num_nodes);
+  m_end.resize(num_nodes);
+  m_stack.clear();
+
+  for (unsigned i = 0; i < num_nodes; i++) {
+    AstOp op = in.get_op(i);
+    long payload = in.get_payload(i);
+    unsigned value;
+
+    if (op == AST_LITERAL) {
+      value = value_number(op, payload, 0);
+    } else if (op == AST_VAR) {
+      value = value_number(op, payload, long(m_version[unsigned(payload)]));
+    } else {
+      m_stack.push_back({ i, 0, 0 });
+      continue;
+    }
+    m_vn[i] = value;
+    m_end[i] = i + 1;
+
+    // deliver the value number to the frames waiting for it
+    while (!m_stack.empty()) {
+      Frame &frame = m_stack.back();
+      AstOp frame_op = in.get_op(frame.node);
+
+      if (frame_op == AST_ASSIGN) {
+        // every assignment is distinct
+        value = m_num_vns++;
+        m_version[unsigned(in.get_payload(frame.node))]++;
+      } else if (frame.state == 0) {
+        frame.state = 1;
+        frame.left = value;
+        break;
+      } else {
+        long a = long(frame.left), b = long(value);
+        if ((frame_op == AST_ADD || frame_op == AST_MUL) && a > b) {
+          // operands of commutative operators are put in a canonical
+          // order (which is safe, since shared expressions can't
+          // contain assignments)
+          std::swap(a, b);
+        }
+        value = value_number(frame_op, a, b);
+      }
+
+      m_vn[frame.node] = value;
+      m_end[frame.node] = i + 1;
+      m_stack.pop_back();
+    }
+  }
+
+  assert(m_stack.empty());
+}
+
+unsigned CommonSubexprEliminator::value_number(int op, long a, long b) {
+  auto result = m_table.insert({ { op, a, b }, m_num_vns });
+  if (result.second) {
+    m_num_vns++;
+  }
+  return result.first->second;
+}
+
+// Determine which operator subexpressions will be evaluated more than
+// once.  The nodes are scanned in preorder, which visits the roots of
+// (non-nested) subexpressions in evaluation order.  When a value number
+// is seen again, the subexpression is skipped, since after elimination
+// it won't be evaluated, and so any subexpressions within it shouldn't
+// be counted as reused.
+void CommonSubexprEliminator::find_reuses(const FlatAst &in) {
+  unsigned num_nodes = in.get_num_nodes();
+  unsigned num_temps = 0;
+
+  m_seen.assign(m_num_vns, 0);
+  m_temp.assign(m_num_vns, NO_TEMP);
+
+  unsigned i = 0;
+  while (i < num_nodes) {
+    if (FlatAst::is_binary(in.get_op(i))) {
+      unsigned value = m_vn[i];
+      if (m_seen[value]) {
+        if (m_temp[value] == NO_TEMP) {
+          m_temp[value] = get_temp_slot(num_temps++);
+          m_num_temps++;
+        }
+        m_num_reuses++;
+        i = m_end[i];
+        continue;
+      }
+      m_seen[value] = 1;
+    }
+    i++;
+  }
+}
+
+// Emit the nodes, wrapping the first occurrence of each reused
+// subexpression in an assignment to its temporary, and replacing later
+// occurrences by a reference to the temporary.  This visits exactly the
+// same nodes as find_reuses.
+void CommonSubexprEliminator::emit(const FlatAst &in, FlatAst &out) {
+  unsigned num_stmts = in.get_num_statements();
+  std::vector<unsigned> out_index;   // output index of each input node that is emitted
+  out_index.resize(in.get_num_nodes(), FlatAst::NO_NODE);
+
+  m_seen.assign(m_num_vns, 0);
+
+  for (unsigned s = 0; s < num_stmts; s++) {
+    out.begin_statement();
+
+    unsigned i = in.get_statement(s), end = in.get_statement_end(s);
+    while (i < end) {
+      AstOp op = in.get_op(i);
+      unsigned value = m_vn[i];
+      unsigned index;
+
+      if (FlatAst::is_binary(op) && m_temp[value] != NO_TEMP && m_seen[value]) {
+        // later occurrence: use the temporary
+        index = out.add_node(AST_VAR, long(m_temp[value]), in.get_loc(i));
+        out_index[i] = index;
+        i = m_end[i];
+        continue;
+      }
+
+      if (FlatAst::is_binary(op) && m_temp[value] != NO_TEMP) {
+        // first occurrence: save the value in the temporary
+        out.add_node(AST_ASSIGN, long(m_temp[value]), in.get_loc(i));
+        m_seen[value] = 1;
+      }
+      index = out.add_node(op, in.get_payload(i), in.get_loc(i));
+      out_index[i] = index;
+      i++;
+    }
+
+    // now that every emitted node has an output index, the right
+    // operands can be set
+    for (unsigned j = in.get_statement(s); j < end; j++) {
+      if (out_index[j] != FlatAst::NO_NODE && FlatAst::is_binary(in.get_op(j))
+          && out.get_op(out_index[j]) != AST_VAR) {
+        out.set_right(out_index[j], out_index[in.get_right(j)]);
+      }
+    }
+  }
+}
+
+// Temporaries are symbols which can't be used as identifiers, so they
+// can't conflict with variables in the program.  The same temporaries
+// are used by each call to eliminate.
+unsigned CommonSubexprEliminator::get_temp_slot(unsigned temp) {
+  return m_symtab->intern(cpputil::format("$cse%u", temp));
+}
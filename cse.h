@@ -0,0 +1,94 @@
+#ifndef CSE_H
+#define CSE_H
+
+#include <cstdio>
+#include <vector>
+#include <unordered_map>
+#include "ast.h"
+#include "symtab.h"
+
+// Common subexpression elimination.  Every node of the AST is given a
+// value number by hash-consing: structurally identical subexpressions
+// (with the operands of + and * in either order) get the same number,
+// so that the value numbers form a DAG of the distinct subexpressions
+// in the unit.  A reference to a variable is numbered by the variable
+// and how many times it has been assigned so far, so that references
+// separated by an assignment are never considered equal, and
+// assignments are never shared.
+//
+// When a subexpression will be evaluated more than once, the first
+// evaluation is wrapped in an assignment to a temporary variable (a
+// symbol whose name can't be an identifier, such as "$cse0"), and
+// later occurrences are replaced by references to it.  Since this
+// only uses existing AST operations, every engine benefits.
+class CommonSubexprEliminator {
+private:
+  struct Key {
+    int op;
+    long a, b;
+    bool operator==(const Key &other) const {
+      return op == other.op && a == other.a && b == other.b;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      size_t h = size_t(k.op) * 0x9E3779B97F4A7C15ULL;
+      h ^= size_t(k.a) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+      h ^= size_t(k.b) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  struct Frame {
+    unsigned node;
+    int state;
+    unsigned left;
+  };
+
+  SymbolTable *m_symtab;
+  std::unordered_map<Key, unsigned, KeyHash> m_table;
+  unsigned m_num_vns;
+  std::vector<unsigned> m_version;   // number of assignments, indexed by slot
+
+  // indexed by input node
+  std::vector<unsigned> m_vn;        // value number
+  std::vector<unsigned> m_end;       // end of subtree
+
+  // indexed by value number
+  std::vector<unsigned char> m_seen;
+  std::vector<unsigned> m_temp;      // slot of temporary variable, if reused
+
+  std::vector<Frame> m_stack;
+
+  // statistics
+  unsigned long m_nodes_before, m_nodes_after, m_num_distinct;
+  unsigned long m_num_temps, m_num_reuses;
+
+  // no value semantics
+  CommonSubexprEliminator(const CommonSubexprEliminator &);
+  CommonSubexprEliminator &operator=(const CommonSubexprEliminator &);
+
+public:
+  enum { NO_TEMP = ~0u };
+
+  CommonSubexprEliminator(SymbolTable *symtab);
+  ~CommonSubexprEliminator();
+
+  // Eliminate common subexpressions from all of the statements in an
+  // AST, appending the result to out.  Subexpressions are only shared
+  // within a single call.
+  void eliminate(const FlatAst &in, FlatAst &out);
+
+  // Print statistics for all calls to eliminate so far
+  void print_stats(FILE *out) const;
+
+private:
+  void number(const FlatAst &in);
+  unsigned value_number(int op, long a, long b);
+  void find_reuses(const FlatAst &in);
+  void emit(const FlatAst &in, FlatAst &out);
+  unsigned get_temp_slot(unsigned temp);
+};
+
+#endif // CSE_H
@@ -0,0 +1,37 @@
+#include "exceptions.h"
+#include "env.h"
+
+////////////////////////////////////////////////////////////////////////
+// Environment implementation
+////////////////////////////////////////////////////////////////////////
+
+Environment::Environment(const SymbolTable *symtab)
+  : m_symtab(symtab) {
+}
+
+Environment::~Environment() {
+}
+
+// The lexer has already interned every identifier into a dense symbol
+// id, so a variable's slot is simply its symbol id, and all that is
+// needed is to make sure there is a slot for every symbol.
+void Environment::resolve_slots() {
+  unsigned num_slots = m_symtab->get_num_symbols();
+  if (m_values.size() < num_slots) {
+    m_values.resize(num_slots, 0);
+    m_defined.resize(num_slots, 0);
+  }
+}
+
+bool Environment::get_var(const std::string &name, long &value) const {
+  int sym = m_symtab->lookup(name);
+  if (sym < 0 || unsigned(sym) >= m_values.size() || !m_defined[unsigned(sym)]) {
+    return false;
+  }
+  value = m_values[unsigned(sym)];
+  return true;
+}
+
+void Environment::undefined_variable(const Location &loc, unsigned slot) const {
+  SemanticError::raise(loc, "Undefined variable '%s'", m_symtab->get_name(slot).c_str());
+}
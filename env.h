@@ -0,0 +1,54 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include <vector>
+#include <string>
+#include "location.h"
+#include "symtab.h"
+
+// Variable storage for the execution engines.  Every variable is
+// assigned a slot index before execution; slot i holds the value of the
+// variable whose symbol id is i, and get_defined()[i] is nonzero once
+// it has been assigned a value.  The slots are flat arrays, so that
+// engines can access them directly.
+class Environment {
+private:
+  const SymbolTable *m_symtab;
+  std::vector<long> m_values;
+  std::vector<unsigned char> m_defined;
+
+  // no value semantics
+  Environment(const Environment &);
+  Environment &operator=(const Environment &);
+
+public:
+  Environment(const SymbolTable *symtab);
+  ~Environment();
+
+  const SymbolTable *get_symtab() const { return m_symtab; }
+
+  // Make sure there is a slot for every symbol in the symbol table.
+  // This must be called before executing code which might refer to
+  // newly-interned symbols.  Values of existing slots are preserved,
+  // but pointers returned by get_values and get_defined may change.
+  void resolve_slots();
+
+  unsigned get_num_slots() const { return unsigned(m_values.size()); }
+  long *get_values() { return m_values.data(); }
+  unsigned char *get_defined() { return m_defined.data(); }
+  const long *get_values() const { return m_values.data(); }
+  const unsigned char *get_defined() const { return m_defined.data(); }
+
+  // Get the value of the variable with given name.  Returns false if
+  // the variable doesn't exist or was never assigned a value.
+  bool get_var(const std::string &name, long &value) const;
+
+  // Raise the error for a reference to an undefined variable
+  void undefined_variable(const Location &loc, unsigned slot) const
+#ifdef __GNUC__
+    __attribute__ ((noreturn))
+#endif
+    ;
+};
+
+#endif // ENV_H
@@ -0,0 +1,222 @@
+#include <cassert>
+#include "arith.h"
+#include "fold.h"
+
+////////////////////////////////////////////////////////////////////////
+// ConstantFolder implementation
+////////////////////////////////////////////////////////////////////////
+
+ConstantFolder::ConstantFolder()
+  : m_num_folded(0) {
+}
+
+ConstantFolder::~ConstantFolder() {
+}
+
+void ConstantFolder::fold(const FlatAst &in, FlatAst &out) {
+  unsigned num_stmts = in.get_num_statements();
+  for (unsigned i = 0; i < num_stmts; i++) {
+    fold_statement(in, i, out);
+  }
+}
+
+// The input statement is scanned in evaluation order, the same way
+// Interpreter::eval scans it, except that rather than computing values,
+// each leaf and each completed operator yields a simplified expression
+// (stored in m_exprs).  Since assignments are processed in evaluation
+// order, what is known about each variable is always up to date when
+// a reference to it is encountered.  Finally, the simplified
+// expression is emitted to the output AST in preorder.
+unsigned ConstantFolder::fold_statement(const FlatAst &in, unsigned stmt, FlatAst &out) {
+  unsigned begin = in.get_statement(stmt), end = in.get_statement_end(stmt);
+  unsigned value = 0;
+
+  m_exprs.clear();
+  m_stack.clear();
+
+  for (unsigned i = begin; i < end; i++) {
+    AstOp op = in.get_op(i);
+
+    if (op == AST_LITERAL || op == AST_VAR) {
+      value = leaf(in, i);
+    } else {
+      m_stack.push_back({ i, 0, 0 });
+      continue;
+    }
+
+    // deliver the value to the frames waiting for it
+    while (!m_stack.empty()) {
+      Frame &frame = m_stack.back();
+      AstOp frame_op = in.get_op(frame.node);
+
+      if (frame_op == AST_ASSIGN) {
+        value = assign(unsigned(in.get_payload(frame.node)), value, in.get_loc(frame.node));
+        m_stack.pop_back();
+        continue;
+      }
+
+      if (frame.state == 0) {
+        frame.state = 1;
+        frame.left = value;
+        break;
+      }
+
+      value = binary(frame_op, frame.left, value, in.get_loc(frame.node));
+      m_stack.pop_back();
+    }
+  }
+
+  assert(m_stack.empty());
+
+  unsigned out_stmt = out.begin_statement();
+  unsigned num_nodes = out.get_num_nodes();
+  emit(value, out);
+  m_num_folded += (end - begin) - (out.get_num_nodes() - num_nodes);
+  return out_stmt;
+}
+
+void ConstantFolder::print_stats(FILE *out) const {
+  fprintf(out, "fold: %u nodes eliminated\n", m_num_folded);
+}
+
+void ConstantFolder::ensure_slot(unsigned slot) {
+  if (slot >= m_assigned.size()) {
+    m_assigned.resize(slot + 1, 0);
+    m_is_const.resize(slot + 1, 0);
+    m_const.resize(slot + 1, 0);
+  }
+}
+
+unsigned ConstantFolder::leaf(const FlatAst &in, unsigned i) {
+  long payload = in.get_payload(i);
+  if (in.get_op(i) == AST_LITERAL) {
+    return literal(payload, in.get_loc(i));
+  }
+
+  unsigned slot = unsigned(payload);
+  ensure_slot(slot);
+  if (m_is_const[slot]) {
+    // propagate the variable's known value
+    return literal(m_const[slot], in.get_loc(i));
+  }
+
+  // a reference to a variable which might not be defined could fail
+  m_exprs.push_back({ AST_VAR, bool(m_assigned[slot]), false, 0, payload, 0, 0, in.get_loc(i) });
+  return unsigned(m_exprs.size() - 1);
+}
+
+unsigned ConstantFolder::assign(unsigned slot, unsigned value, const Location &loc) {
+  ensure_slot(slot);
+  const Expr &e = m_exprs[value];
+  m_assigned[slot] = 1;
+  m_is_const[slot] = e.known;
+  m_const[slot] = e.value;
+
+  m_exprs.push_back({ AST_ASSIGN, false, e.known, e.value, long(slot), value, 0, loc });
+  return unsigned(m_exprs.size() - 1);
+}
+
+unsigned ConstantFolder::binary(AstOp op, unsigned left, unsigned right, const Location &loc) {
+  const Expr &l = m_exprs[left], &r = m_exprs[right];
+
+  // compute the value if possible
+  bool known = false;
+  long value = 0;
+  if (l.known && r.known) {
+    switch (op) {
+    case AST_ADD:
+      known = true;
+      value = arith::add(l.value, r.value);
+      break;
+    case AST_SUB:
+      known = true;
+      value = arith::sub(l.value, r.value);
+      break;
+    case AST_MUL:
+      known = true;
+      value = arith::mul(l.value, r.value);
+      break;
+    case AST_DIV:
+      // division by zero is left for run time, so that the error is raised
+      if (r.value != 0) {
+        known = true;
+        value = arith::div(l.value, r.value);
+      }
+      break;
+    default:
+      break;
+    }
+  } else if (op == AST_MUL && ((l.known && l.value == 0) || (r.known && r.value == 0))) {
+    known = true;
+    value = 0;
+  }
+
+  // a pure expression with a known value is replaced by a literal
+  bool pure = l.pure && r.pure && (op != AST_DIV || (r.known && r.value != 0));
+  if (known && pure) {
+    return literal(value, loc);
+  }
+
+  // identities
+  switch (op) {
+  case AST_ADD:
+    if (is_literal(right, 0))
+      return left;
+    if (is_literal(left, 0))
+      return right;
+    break;
+  case AST_SUB:
+    if (is_literal(right, 0))
+      return left;
+    break;
+  case AST_MUL:
+    if (is_literal(right, 1))
+      return left;
+    if (is_literal(left, 1))
+      return right;
+    break;
+  case AST_DIV:
+    if (is_literal(right, 1))
+      return left;
+    break;
+  default:
+    break;
+  }
+
+  m_exprs.push_back({ op, pure, known, value, 0, left, right, loc });
+  return unsigned(m_exprs.size() - 1);
+}
+
+unsigned ConstantFolder::literal(long value, const Location &loc) {
+  m_exprs.push_back({ AST_LITERAL, true, true, value, value, 0, 0, loc });
+  return unsigned(m_exprs.size() - 1);
+}
+
+bool ConstantFolder::is_literal(unsigned e, long value) const {
+  return m_exprs[e].op == AST_LITERAL && m_exprs[e].payload == value;
+}
+
+// Emit a simplified expression in preorder, using an explicit worklist
+// of (expression, index of the operator whose right operand it is)
+void ConstantFolder::emit(unsigned root, FlatAst &out) {
+  m_work.clear();
+  m_work.push_back({ root, FlatAst::NO_NODE });
+
+  while (!m_work.empty()) {
+    const Expr &e = m_exprs[m_work.back().first];
+    unsigned patch = m_work.back().second;
+    m_work.pop_back();
+
+    unsigned index = out.add_node(e.op, e.payload, e.loc);
+    if (patch != FlatAst::NO_NODE) {
+      out.set_right(patch, index);
+    }
+
+    if (e.op == AST_ASSIGN) {
+      m_work.push_back({ e.left, FlatAst::NO_NODE });
+    } else if (FlatAst::is_binary(e.op)) {
+      m_work.push_back({ e.right, index });
+      m_work.push_back({ e.left, FlatAst::NO_NODE });
+    }
+  }
+}
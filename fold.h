@@ -0,0 +1,88 @@
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <cstdio>
+#include <vector>
+#include "location.h"
+#include "ast.h"
+
+// Optimization pass which folds constant subexpressions, applies
+// algebraic identities (x+0, 0+x, x-0, x*1, 1*x, x/1, and x*0 or 0*x
+// when x has no side effects), and propagates constant values of
+// variables through assignments to later uses.  The value of an
+// expression with side effects may still be known (e.g., the value of
+// = x 3 is 3), in which case it is propagated to the variable assigned,
+// even though the expression itself can't be replaced by a literal.
+//
+// Semantics are preserved exactly: assignments are never removed
+// (even if their value is known), a division by zero is never folded
+// (so the error is still raised at run time), and subexpressions which
+// could raise an error (a reference to a variable which might not be
+// defined, or a division which might be by zero) are treated as having
+// side effects.  What is known about variables carries over from one
+// statement to the next, so statements can be folded one at a time
+// as they are parsed.
+class ConstantFolder {
+private:
+  // A node of the simplified expression being built
+  struct Expr {
+    AstOp op;
+    bool pure;        // evaluating it has no side effects and can't fail
+    bool known;       // value is known (if evaluation completes)...
+    long value;       // ...and is this
+    long payload;
+    unsigned left, right;
+    Location loc;
+  };
+
+  // An operator or assignment from the input whose operands are
+  // being folded
+  struct Frame {
+    unsigned node;
+    int state;
+    unsigned left;
+  };
+
+  // Knowledge about variables, indexed by slot
+  std::vector<unsigned char> m_assigned;   // definitely has a value
+  std::vector<unsigned char> m_is_const;   // value is known...
+  std::vector<long> m_const;               // ...and is this
+
+  std::vector<Expr> m_exprs;
+  std::vector<Frame> m_stack;
+  std::vector<std::pair<unsigned, unsigned>> m_work;
+
+  unsigned m_num_folded;
+
+  // no value semantics
+  ConstantFolder(const ConstantFolder &);
+  ConstantFolder &operator=(const ConstantFolder &);
+
+public:
+  ConstantFolder();
+  ~ConstantFolder();
+
+  // Fold all of the statements in an AST, appending them to out
+  void fold(const FlatAst &in, FlatAst &out);
+
+  // Fold a single statement, appending it to out.  Returns the index
+  // of the statement in out.
+  unsigned fold_statement(const FlatAst &in, unsigned stmt, FlatAst &out);
+
+  // Number of AST nodes eliminated so far
+  unsigned get_num_folded() const { return m_num_folded; }
+
+  // Print statistics for all statements folded so far
+  void print_stats(FILE *out) const;
+
+private:
+  void ensure_slot(unsigned slot);
+  unsigned leaf(const FlatAst &in, unsigned i);
+  unsigned assign(unsigned slot, unsigned value, const Location &loc);
+  unsigned binary(AstOp op, unsigned left, unsigned right, const Location &loc);
+  unsigned literal(long value, const Location &loc);
+  bool is_literal(unsigned e, long value) const;
+  void emit(unsigned root, FlatAst &out);
+};
+
+#endif // FOLD_H
@@ -0,0 +1,63 @@
+#! /bin/sh
+
+# Randomized check of fork-join evaluation: runs random programs with
+# a build of pfxcalc whose FORK_MIN_NODES is lowered so that even small
+# operators are split between threads (see "make forkcheck"), and
+# compares the output with sequential evaluation.  The programs have
+# independent statements (so that the threads also run statements
+# concurrently), variables which may be undefined, and divisions
+# which may be by zero, so that errors are raised by forked operands.
+#
+# Usage: forkcheck.sh [programs] [seed]
+
+COUNT=${1:-200}
+SEED=${2:-1}
+PFXCALC=${PFXCALC:-./pfxcalc}
+FORKTEST=${FORKTEST:-./pfxcalc-forktest}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+failures=0
+i=0
+while [ $i -lt "$COUNT" ]; do
+	awk -v seed=$((SEED * 100003 + i)) '
+	function leaf() {
+		# mostly defined variables and nonzero literals, so that most
+		# statements get far enough to fork
+		if (rand() < 0.5) return (rand() < 0.05) ? 0 : 1 + int(rand() * 4);
+		return (rand() < 0.01) ? "d" : substr("abc", int(rand() * 3) + 1, 1);
+	}
+	function expr(depth,   r, op) {
+		r = rand();
+		if (depth > 7 || r < 0.1) return leaf();
+		if (r < 0.13) return "= " substr("abcd", int(rand() * 4) + 1, 1) " " expr(depth + 1);
+		op = substr("+++++++*******-/", int(rand() * 16) + 1, 1);
+		return op " " expr(depth + 1) " " expr(depth + 1);
+	}
+	BEGIN {
+		srand(seed);
+		print "= a 1; = b 2; = c 3;";
+		n = 1 + int(rand() * 6);
+		for (s = 0; s < n; s++) print expr(0) ";";
+	}' > "$DIR/prog.pfx"
+
+	for opts in "" "-R"; do
+		expected=$("$PFXCALC" $opts "$DIR/prog.pfx" 2>&1)
+		for t in 2 8 64; do
+			actual=$("$FORKTEST" $opts -t $t "$DIR/prog.pfx" 2>&1)
+			if [ "$actual" != "$expected" ]; then
+				echo "FAILED  program $i ($opts -t $t): expected '$expected', got '$actual'"
+				cat "$DIR/prog.pfx"
+				failures=$((failures + 1))
+			fi
+		done
+	done
+	i=$((i + 1))
+done
+
+if [ $failures -eq 0 ]; then
+	echo "forkcheck: $COUNT programs, all passed"
+else
+	echo "forkcheck: $failures failures"
+	exit 1
+fi
@@ -0,0 +1,169 @@
+// Randomized check of incremental re-evaluation (pfx_update) against
+// full evaluation (pfx_eval).  Generates random programs, and for each,
+// changes its inputs one at a time with pfx_update, comparing the
+// result, the error (and its location), and the value of every
+// variable with those of evaluating the program with the same inputs
+// in a fresh environment.  The programs divide by variables and read
+// variables before they are assigned, so that updates cause and fix
+// errors.
+//
+// Usage: incrcheck [programs] [updates per program] [seed]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "pfxcalc.h"
+
+namespace {
+
+const char *const VARS[] = { "a", "b", "c", "d", "e", "f" };
+const unsigned NUM_VARS = sizeof(VARS) / sizeof(VARS[0]);
+
+unsigned s_seed;
+
+unsigned rnd(unsigned n) {
+  s_seed = s_seed * 1103515245u + 12345u;
+  return (s_seed >> 16) % n;
+}
+
+void gen_expr(std::string &text, unsigned depth) {
+  unsigned choice = rnd(depth > 3 ? 2 : 10);
+  if (choice == 0) {
+    text += std::to_string(rnd(5));
+  } else if (choice == 1) {
+    text += VARS[rnd(NUM_VARS)];
+  } else if (choice < 4) {
+    text += "= ";
+    text += VARS[rnd(NUM_VARS)];
+    text += ' ';
+    gen_expr(text, depth + 1);
+  } else {
+    text += "+-*/"[rnd(4)];
+    text += ' ';
+    gen_expr(text, depth + 1);
+    text += ' ';
+    gen_expr(text, depth + 1);
+  }
+}
+
+std::string gen_program() {
+  std::string text;
+  unsigned num_stmts = 1 + rnd(12);
+  for (unsigned i = 0; i < num_stmts; i++) {
+    gen_expr(text, 0);
+    text += ";\n";
+  }
+  return text;
+}
+
+// Snapshot of the outcome of an evaluation
+struct Outcome {
+  int code, line, col;
+  long result;
+  std::vector<int> var_codes;
+  std::vector<long> var_values;
+
+  std::string describe() const {
+    std::string s = "code " + std::to_string(code);
+    if (code == PFX_OK) {
+      s += " result " + std::to_string(result);
+    } else {
+      s += " at " + std::to_string(line) + ":" + std::to_string(col);
+    }
+    for (unsigned i = 0; i < var_codes.size(); i++) {
+      s += var_codes[i] == PFX_OK ? " " + std::to_string(var_values[i]) : " ?";
+    }
+    return s;
+  }
+
+  bool operator==(const Outcome &other) const {
+    return code == other.code && line == other.line && col == other.col
+      && (code != PFX_OK || result == other.result)
+      && var_codes == other.var_codes && var_values == other.var_values;
+  }
+};
+
+Outcome get_outcome(const pfx_program *prog, const pfx_env *env, int code,
+                    long result, const pfx_error &err) {
+  Outcome out;
+  out.code = code;
+  out.line = code == PFX_OK ? 0 : err.line;
+  out.col = code == PFX_OK ? 0 : err.col;
+  out.result = result;
+  for (unsigned i = 0; i < pfx_num_vars(prog); i++) {
+    long value = 0;
+    out.var_codes.push_back(pfx_get_index(env, i, &value));
+    out.var_values.push_back(value);
+  }
+  return out;
+}
+
+// Check one program, returning false if incremental and full
+// evaluation disagree
+bool check_program(const std::string &text, unsigned num_updates) {
+  pfx_program *prog;
+  pfx_error err;
+  if (pfx_compile(text.c_str(), text.size(), PFX_INCREMENTAL, &prog, &err) != PFX_OK) {
+    fprintf(stderr, "Error compiling program: %s\n%s", err.message, text.c_str());
+    return false;
+  }
+
+  unsigned num_vars = pfx_num_vars(prog);
+  std::vector<long> inputs(num_vars, 0);
+  std::vector<bool> inputs_set(num_vars, false);
+  pfx_env *incr_env = pfx_env_create(prog);
+  bool ok = true;
+
+  for (unsigned u = 0; u < num_updates && ok && num_vars > 0; u++) {
+    unsigned index = rnd(num_vars);
+    long value = long(rnd(4));
+    inputs[index] = value;
+    inputs_set[index] = true;
+
+    long incr_result = 0;
+    int incr_code = pfx_update_index(prog, incr_env, index, value, &incr_result, &err);
+    Outcome incr = get_outcome(prog, incr_env, incr_code, incr_result, err);
+
+    pfx_env *env = pfx_env_create(prog);
+    for (unsigned i = 0; i < num_vars; i++) {
+      if (inputs_set[i]) {
+        pfx_set_index(env, i, inputs[i]);
+      }
+    }
+    long full_result = 0;
+    int full_code = pfx_eval(prog, env, &full_result, &err);
+    Outcome full = get_outcome(prog, env, full_code, full_result, err);
+    pfx_env_free(env);
+
+    if (!(incr == full)) {
+      fprintf(stderr, "Mismatch after update %u (%s = %ld):\n%s", u,
+              pfx_var_name(prog, index), value, text.c_str());
+      fprintf(stderr, "  incremental: %s\n  full:        %s\n",
+              incr.describe().c_str(), full.describe().c_str());
+      ok = false;
+    }
+  }
+
+  pfx_env_free(incr_env);
+  pfx_program_free(prog);
+  return ok;
+}
+
+}
+
+int main(int argc, char **argv) {
+  unsigned num_programs = (argc > 1) ? unsigned(atoi(argv[1])) : 400;
+  unsigned num_updates = (argc > 2) ? unsigned(atoi(argv[2])) : 40;
+  s_seed = (argc > 3) ? unsigned(atoi(argv[3])) : 1;
+
+  unsigned failures = 0;
+  for (unsigned i = 0; i < num_programs; i++) {
+    if (!check_program(gen_program(), num_updates)) {
+      failures++;
+    }
+  }
+
+  printf("incrcheck: %u programs, %u failed\n", num_programs, failures);
+  return failures > 0 ? 1 : 0;
+}
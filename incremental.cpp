@@ -0,0 +1,331 @@
+#include <algorithm>
+#include "exceptions.h"
+#include "incremental.h"
+
+////////////////////////////////////////////////////////////////////////
+// IncrementalEvaluator implementation
+////////////////////////////////////////////////////////////////////////
+
+IncrementalEvaluator::IncrementalEvaluator(const FlatAst *ast, Environment *env)
+  : m_ast(ast)
+  , m_env(env)
+  , m_interp(ast, env)
+  , m_num_slots(0)
+  , m_executed(false)
+  , m_had_failure(false)
+  , m_num_updates(0)
+  , m_num_evals(0) {
+  m_env->resolve_slots();
+  m_num_slots = m_env->get_num_slots();
+  find_uses_and_defs();
+
+  unsigned num_stmts = m_ast->get_num_statements();
+  m_def_values.assign(m_def_slots.size(), 0);
+  m_def_defined.assign(m_def_slots.size(), 0);
+  m_partial_values.assign(m_def_slots.size(), 0);
+  m_partial_defined.assign(m_def_slots.size(), 0);
+  m_input_values.assign(m_num_slots, 0);
+  m_input_defined.assign(m_num_slots, 0);
+  m_results.assign(num_stmts, 0);
+  m_failed.assign(num_stmts, 0);
+  m_errors.resize(num_stmts);
+  m_queued.assign(num_stmts, 0);
+  m_touched_mark.assign(m_num_slots, 0);
+}
+
+IncrementalEvaluator::~IncrementalEvaluator() {
+}
+
+long IncrementalEvaluator::exec() {
+  // the current values are the inputs
+  const long *values = m_env->get_values();
+  const unsigned char *defined = m_env->get_defined();
+  m_input_values.assign(values, values + m_num_slots);
+  m_input_defined.assign(defined, defined + m_num_slots);
+
+  // forget the outcome of any previous evaluation, and evaluate
+  // every statement
+  std::fill(m_def_defined.begin(), m_def_defined.end(), 0);
+  m_failures.clear();
+  unsigned num_stmts = m_ast->get_num_statements();
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    if (!m_queued[stmt]) {
+      m_queued[stmt] = 1;
+      m_dirty.push(stmt);
+    }
+  }
+  m_executed = true;
+  return update();
+}
+
+long IncrementalEvaluator::set_var(unsigned slot, long value) {
+  return update_input(slot, true, value);
+}
+
+long IncrementalEvaluator::unset_var(unsigned slot) {
+  return update_input(slot, false, 0);
+}
+
+void IncrementalEvaluator::print_stats(FILE *out) const {
+  fprintf(out, "incremental: %lu updates, %lu statement evaluations for %u statements\n",
+          m_num_updates, m_num_evals, m_ast->get_num_statements());
+}
+
+// Find the variables each statement reads and assigns, which statement's
+// assignment each read sees, and which statements see each assignment.
+// There is no control flow, so every execution of a statement reads and
+// assigns the same variables, and these can be found from the AST.
+void IncrementalEvaluator::find_uses_and_defs() {
+  unsigned num_stmts = m_ast->get_num_statements();
+  std::vector<unsigned> use_mark(m_num_slots, ~0u), def_mark(m_num_slots, ~0u);
+  m_last_def.assign(m_num_slots, NO_DEF);
+
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    m_uses_start.push_back(unsigned(m_use_slots.size()));
+    m_defs_start.push_back(unsigned(m_def_slots.size()));
+
+    unsigned end = m_ast->get_statement_end(stmt);
+    for (unsigned i = m_ast->get_statement(stmt); i < end; i++) {
+      unsigned slot = unsigned(m_ast->get_payload(i));
+      AstOp op = m_ast->get_op(i);
+      if (op == AST_VAR && use_mark[slot] != stmt) {
+        use_mark[slot] = stmt;
+        m_use_slots.push_back(slot);
+        m_use_defs.push_back(m_last_def[slot]);
+        m_use_weak.push_back(0);
+      } else if (op == AST_ASSIGN && def_mark[slot] != stmt) {
+        def_mark[slot] = stmt;
+        m_def_slots.push_back(slot);
+        m_def_stmts.push_back(stmt);
+      }
+    }
+    for (unsigned j = m_defs_start[stmt]; j < m_def_slots.size(); j++) {
+      unsigned slot = m_def_slots[j];
+      if (use_mark[slot] != stmt) {
+        use_mark[slot] = stmt;
+        m_use_slots.push_back(slot);
+        m_use_defs.push_back(m_last_def[slot]);
+        m_use_weak.push_back(1);
+      }
+    }
+
+    for (unsigned j = m_defs_start[stmt]; j < m_def_slots.size(); j++) {
+      m_last_def[m_def_slots[j]] = j;
+    }
+  }
+
+  m_uses_start.push_back(unsigned(m_use_slots.size()));
+  m_defs_start.push_back(unsigned(m_def_slots.size()));
+
+  // group the assignments by slot (they are already in statement order)
+  unsigned num_defs = unsigned(m_def_slots.size());
+  m_slot_defs_start.assign(m_num_slots + 1, 0);
+  for (unsigned j = 0; j < num_defs; j++) {
+    m_slot_defs_start[m_def_slots[j] + 1]++;
+  }
+  for (unsigned j = 0; j < m_num_slots; j++) {
+    m_slot_defs_start[j + 1] += m_slot_defs_start[j];
+  }
+  m_slot_defs.resize(num_defs);
+  std::vector<unsigned> next_def(m_slot_defs_start.begin(), m_slot_defs_start.end() - 1);
+  for (unsigned j = 0; j < num_defs; j++) {
+    m_slot_defs[next_def[m_def_slots[j]]++] = j;
+  }
+
+  // invert the reads to find the readers of each assignment and input
+  m_readers_start.assign(num_defs + 1, 0);
+  m_input_readers_start.assign(m_num_slots + 1, 0);
+  for (unsigned j = 0; j < m_use_defs.size(); j++) {
+    if (m_use_defs[j] == NO_DEF) {
+      m_input_readers_start[m_use_slots[j] + 1]++;
+    } else {
+      m_readers_start[m_use_defs[j] + 1]++;
+    }
+  }
+  for (unsigned j = 0; j < num_defs; j++) {
+    m_readers_start[j + 1] += m_readers_start[j];
+  }
+  for (unsigned j = 0; j < m_num_slots; j++) {
+    m_input_readers_start[j + 1] += m_input_readers_start[j];
+  }
+  m_readers.resize(m_readers_start[num_defs]);
+  m_input_readers.resize(m_input_readers_start[m_num_slots]);
+
+  std::vector<unsigned> next(m_readers_start.begin(), m_readers_start.end() - 1);
+  std::vector<unsigned> next_input(m_input_readers_start.begin(), m_input_readers_start.end() - 1);
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    for (unsigned j = m_uses_start[stmt]; j < m_uses_start[stmt + 1]; j++) {
+      if (m_use_defs[j] == NO_DEF) {
+        m_input_readers[next_input[m_use_slots[j]]++] = stmt;
+      } else {
+        m_readers[next[m_use_defs[j]]++] = stmt;
+      }
+    }
+  }
+}
+
+long IncrementalEvaluator::update_input(unsigned slot, bool defined, long value) {
+  if (slot >= m_num_slots) {
+    RuntimeError::raise("Invalid variable slot %u", slot);
+  }
+  if (!m_executed) {
+    m_env->get_values()[slot] = value;
+    m_env->get_defined()[slot] = defined;
+    return exec();
+  }
+
+  if (defined != bool(m_input_defined[slot]) || (defined && value != m_input_values[slot])) {
+    m_input_values[slot] = value;
+    m_input_defined[slot] = defined;
+    touch(slot);
+    add_readers(m_input_readers_start, m_input_readers, slot);
+    m_num_updates++;
+  }
+  return update();
+}
+
+// Queue the statements which read an assignment or input
+void IncrementalEvaluator::add_readers(const std::vector<unsigned> &start,
+                                       const std::vector<unsigned> &readers, unsigned index) {
+  for (unsigned j = start[index]; j < start[index + 1]; j++) {
+    unsigned stmt = readers[j];
+    if (!m_queued[stmt]) {
+      m_queued[stmt] = 1;
+      m_dirty.push(stmt);
+    }
+  }
+}
+
+// Re-evaluate the queued statements (and the statements they affect),
+// then put the final values of the variables involved back in the
+// Environment.  If a statement failed, the final value of a variable
+// is its value when the earliest failing statement failed, which can
+// depend on which statement that is, so while there are errors (and
+// after the update which fixes them) every variable is put back.
+long IncrementalEvaluator::update() {
+  while (!m_dirty.empty()) {
+    unsigned stmt = m_dirty.top();
+    m_dirty.pop();
+    m_queued[stmt] = 0;
+    eval_statement(stmt);
+  }
+
+  long *values = m_env->get_values();
+  unsigned char *defined = m_env->get_defined();
+  unsigned first_failure = m_failures.empty() ? NO_DEF : *m_failures.begin();
+  if (first_failure != NO_DEF || m_had_failure) {
+    for (unsigned slot = 0; slot < m_num_slots; slot++) {
+      store_final_value(slot, first_failure, values, defined);
+    }
+  } else {
+    for (auto i = m_touched.begin(); i != m_touched.end(); ++i) {
+      store_final_value(*i, first_failure, values, defined);
+    }
+  }
+  for (auto i = m_touched.begin(); i != m_touched.end(); ++i) {
+    m_touched_mark[*i] = 0;
+  }
+  m_touched.clear();
+  m_had_failure = (first_failure != NO_DEF);
+
+  if (first_failure != NO_DEF) {
+    std::rethrow_exception(m_errors[first_failure]);
+  }
+  unsigned num_stmts = m_ast->get_num_statements();
+  return num_stmts > 0 ? m_results[num_stmts - 1] : -1;
+}
+
+// Evaluate a statement with the values its reads see, and queue the
+// statements which read any of its assignments whose value changed
+void IncrementalEvaluator::eval_statement(unsigned stmt) {
+  long *values = m_env->get_values();
+  unsigned char *defined = m_env->get_defined();
+  bool blocked = false;
+
+  for (unsigned j = m_uses_start[stmt]; j < m_uses_start[stmt + 1]; j++) {
+    unsigned slot = m_use_slots[j], def = m_use_defs[j];
+    touch(slot);
+    blocked = blocked || (def != NO_DEF && !m_use_weak[j] && m_failed[m_def_stmts[def]]);
+    set_seen_value(slot, def, values, defined);
+  }
+
+  bool failed = blocked;
+  std::exception_ptr error;
+  if (!blocked) {
+    m_num_evals++;
+    try {
+      m_results[stmt] = m_interp.eval_statement(stmt);
+    } catch (BaseException &) {
+      failed = true;
+      error = std::current_exception();
+    }
+  }
+  m_failed[stmt] = failed;
+  m_errors[stmt] = error;
+  if (error) {
+    m_failures.insert(stmt);
+    for (unsigned j = m_defs_start[stmt]; j < m_defs_start[stmt + 1]; j++) {
+      m_partial_values[j] = values[m_def_slots[j]];
+      m_partial_defined[j] = defined[m_def_slots[j]];
+    }
+  } else {
+    m_failures.erase(stmt);
+  }
+
+  for (unsigned j = m_defs_start[stmt]; j < m_defs_start[stmt + 1]; j++) {
+    unsigned slot = m_def_slots[j];
+    long value = failed ? 0 : values[slot];
+    if (failed == bool(m_def_defined[j]) || value != m_def_values[j]) {
+      m_def_values[j] = value;
+      m_def_defined[j] = !failed;
+      add_readers(m_readers_start, m_readers, j);
+    }
+  }
+}
+
+void IncrementalEvaluator::touch(unsigned slot) {
+  if (!m_touched_mark[slot]) {
+    m_touched_mark[slot] = 1;
+    m_touched.push_back(slot);
+  }
+}
+
+// Put the value an assignment (or the input value, if def is NO_DEF)
+// gives a slot in the Environment
+void IncrementalEvaluator::set_seen_value(unsigned slot, unsigned def,
+                                          long *values, unsigned char *defined) const {
+  if (def == NO_DEF) {
+    values[slot] = m_input_values[slot];
+    defined[slot] = m_input_defined[slot];
+  } else {
+    values[slot] = m_def_values[def];
+    defined[slot] = m_def_defined[def];
+  }
+}
+
+// Put the final value of a slot in the Environment: the value of its
+// last assignment, or, if a statement failed, its value at the point
+// the earliest failing statement failed
+void IncrementalEvaluator::store_final_value(unsigned slot, unsigned first_failure,
+                                             long *values, unsigned char *defined) const {
+  if (first_failure == NO_DEF) {
+    set_seen_value(slot, m_last_def[slot], values, defined);
+    return;
+  }
+
+  // find the last assignment of the slot by a statement which was
+  // executed (the statements up to and including the failed one)
+  auto begin = m_slot_defs.begin() + m_slot_defs_start[slot];
+  auto end = m_slot_defs.begin() + m_slot_defs_start[slot + 1];
+  auto i = std::upper_bound(begin, end, first_failure, [this](unsigned stmt, unsigned def) {
+    return stmt < m_def_stmts[def];
+  });
+  if (i == begin) {
+    set_seen_value(slot, NO_DEF, values, defined);
+  } else if (m_def_stmts[*(i - 1)] == first_failure) {
+    values[slot] = m_partial_values[*(i - 1)];
+    defined[slot] = m_partial_defined[*(i - 1)];
+  } else {
+    set_seen_value(slot, *(i - 1), values, defined);
+  }
+}
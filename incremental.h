@@ -0,0 +1,138 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstdio>
+#include <vector>
+#include <set>
+#include <queue>
+#include <functional>
+#include <exception>
+#include "ast.h"
+#include "env.h"
+#include "interp.h"
+
+// Re-evaluates a unit incrementally when the input value of a variable
+// changes, spreadsheet style.  There is no control flow, so every
+// evaluation of a statement reads the same variables, and sees the
+// assignments of the same earlier statements (or the input values):
+// these dependences are found once, and the outcome of the last
+// evaluation of each statement is kept.  When an input changes, only the
+// statements which read it are re-evaluated, and then the statements
+// which read a variable whose value one of those changed, and so on,
+// in statement order.  A statement whose assignments produce the same
+// values as before doesn't affect any other statement, so the cost
+// of an update depends on how much of the unit it affects rather than
+// on the size of the unit.
+//
+// The input value of a variable is its value before the first statement
+// is executed (as for exec), so changing it doesn't affect statements
+// which read the variable after the unit assigns it.
+//
+// The result, the final variable values, and any error are the same as
+// for executing the whole unit with the current input values.  If a
+// statement fails, the statements reading its assignments can't be
+// executed, but other statements are, so that a later update which
+// fixes the error only needs to re-evaluate the statements affected.
+// Their assignments aren't put in the Environment, though: after an
+// error, the variables have the values they had when the earliest
+// failing statement failed, as if execution had stopped there.
+class IncrementalEvaluator {
+private:
+  enum { NO_DEF = ~0u };
+
+  const FlatAst *m_ast;
+  Environment *m_env;
+  Interpreter m_interp;
+  unsigned m_num_slots;
+
+  // Variables read by each statement (statement i's are elements
+  // m_uses_start[i] .. m_uses_start[i+1]-1), with the assignment each
+  // read sees (an index into the defs, or NO_DEF for the input value).
+  // Every read is treated as seeing the value from before the
+  // statement, which can only cause extra re-evaluation.  A variable
+  // the statement assigns is also treated as read, since it keeps its
+  // previous value if the statement fails before assigning it, but
+  // such a weak read doesn't stop the statement from being evaluated
+  // when the previous value's statement failed.
+  std::vector<unsigned> m_uses_start, m_use_slots, m_use_defs;
+  std::vector<unsigned char> m_use_weak;
+
+  // Variables assigned by each statement, and the value each has
+  // afterwards (undefined if the statement failed).  For a failed
+  // statement, the partial values are the values its variables had
+  // when it failed (some of its assignments may have been executed).
+  std::vector<unsigned> m_defs_start, m_def_slots, m_def_stmts;
+  std::vector<long> m_def_values, m_partial_values;
+  std::vector<unsigned char> m_def_defined, m_partial_defined;
+
+  // Assignments of each slot, in statement order (slot i's are
+  // elements m_slot_defs_start[i] .. m_slot_defs_start[i+1]-1)
+  std::vector<unsigned> m_slot_defs_start, m_slot_defs;
+
+  // Statements whose reads see each assignment, and each input value
+  std::vector<unsigned> m_readers_start, m_readers;
+  std::vector<unsigned> m_input_readers_start, m_input_readers;
+
+  // input value and last assignment of each slot
+  std::vector<long> m_input_values;
+  std::vector<unsigned char> m_input_defined;
+  std::vector<unsigned> m_last_def;
+
+  // Outcome of each statement.  A statement which reads an assignment
+  // by a failed statement fails without being evaluated (it would not
+  // have been executed), and has no error of its own.
+  std::vector<long> m_results;
+  std::vector<unsigned char> m_failed;
+  std::vector<std::exception_ptr> m_errors;
+  std::set<unsigned> m_failures;     // statements with errors of their own
+
+  // statements to re-evaluate, in order
+  std::priority_queue<unsigned, std::vector<unsigned>, std::greater<unsigned>> m_dirty;
+  std::vector<unsigned char> m_queued;
+
+  // slots whose values in the Environment must be restored after an update
+  std::vector<unsigned> m_touched;
+  std::vector<unsigned char> m_touched_mark;
+
+  bool m_executed;
+  bool m_had_failure;   // the previous update ended with an error
+  unsigned long m_num_updates, m_num_evals;
+
+  // no value semantics
+  IncrementalEvaluator(const IncrementalEvaluator &);
+  IncrementalEvaluator &operator=(const IncrementalEvaluator &);
+
+public:
+  IncrementalEvaluator(const FlatAst *ast, Environment *env);
+  ~IncrementalEvaluator();
+
+  // Execute every statement, using the current variable values in the
+  // Environment as the input values.  Returns the value of the last
+  // statement, or raises the error sequential execution would raise.
+  // Afterwards, the Environment has the final variable values.
+  long exec();
+
+  // Change the input value of the variable with given slot, and
+  // return the updated result (or raise the error), as for exec.
+  // If exec hasn't been called yet, it is called to evaluate the unit.
+  long set_var(unsigned slot, long value);
+
+  // Make the variable with given slot undefined on input
+  long unset_var(unsigned slot);
+
+  void print_stats(FILE *out) const;
+
+private:
+  void find_uses_and_defs();
+  long update_input(unsigned slot, bool defined, long value);
+  void add_readers(const std::vector<unsigned> &start, const std::vector<unsigned> &readers,
+                   unsigned index);
+  long update();
+  void eval_statement(unsigned stmt);
+  void touch(unsigned slot);
+  void set_seen_value(unsigned slot, unsigned def, long *values, unsigned char *defined) const;
+  void store_final_value(unsigned slot, unsigned first_failure,
+                         long *values, unsigned char *defined) const;
+};
+
+#endif // INCREMENTAL_H
@@ -0,0 +1,129 @@
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "exceptions.h"
+#include "input.h"
+
+////////////////////////////////////////////////////////////////////////
+// InputSource implementation
+////////////////////////////////////////////////////////////////////////
+
+InputSource::InputSource()
+  : m_begin(nullptr)
+  , m_end(nullptr)
+  , m_base(0) {
+}
+
+InputSource::~InputSource() {
+}
+
+InputSource *InputSource::create(FILE *in) {
+  struct stat st;
+  int fd = fileno(in);
+
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size_t size = size_t(st.st_size);
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, size, MADV_SEQUENTIAL);
+      return new MmapInputSource(map, size);
+    }
+    // if the file can't be mapped, fall back on reading it
+  }
+
+  return new BufferedInputSource(in);
+}
+
+////////////////////////////////////////////////////////////////////////
+// MmapInputSource implementation
+////////////////////////////////////////////////////////////////////////
+
+MmapInputSource::MmapInputSource(void *map, size_t size)
+  : m_map(map)
+  , m_size(size) {
+  m_begin = static_cast<const char *>(map);
+  m_end = m_begin + size;
+}
+
+MmapInputSource::~MmapInputSource() {
+  munmap(m_map, m_size);
+}
+
+bool MmapInputSource::more(const char *keep) {
+  // The entire file is already available, so there is no more
+  // input: just drop the bytes before keep from the window
+  m_base += (unsigned long) (keep - m_begin);
+  m_begin = keep;
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+// MemoryInputSource implementation
+////////////////////////////////////////////////////////////////////////
+
+MemoryInputSource::MemoryInputSource(const char *data, size_t size) {
+  m_begin = data;
+  m_end = data + size;
+}
+
+MemoryInputSource::~MemoryInputSource() {
+}
+
+bool MemoryInputSource::more(const char *keep) {
+  m_base += (unsigned long) (keep - m_begin);
+  m_begin = keep;
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////
+// BufferedInputSource implementation
+////////////////////////////////////////////////////////////////////////
+
+BufferedInputSource::BufferedInputSource(FILE *in)
+  : m_in(in)
+  , m_buf(BLOCK_SIZE)
+  , m_eof(false) {
+  m_begin = m_end = m_buf.data();
+}
+
+BufferedInputSource::~BufferedInputSource() {
+}
+
+bool BufferedInputSource::more(const char *keep) {
+  size_t nkeep = size_t(m_end - keep);
+  m_base += (unsigned long) (keep - m_begin);
+
+  // move retained bytes to the beginning of the buffer, growing
+  // the buffer if they don't leave room for a full block
+  memmove(m_buf.data(), keep, nkeep);
+  if (m_buf.size() < nkeep + BLOCK_SIZE) {
+    m_buf.resize(nkeep + BLOCK_SIZE);
+  }
+  m_begin = m_buf.data();
+  m_end = m_begin + nkeep;
+
+  if (m_eof) {
+    return false;
+  }
+
+  // Use read rather than fread so that we get whatever data is
+  // available on a pipe or terminal without waiting for a full block
+  ssize_t n;
+  do {
+    n = read(fileno(m_in), m_buf.data() + nkeep, m_buf.size() - nkeep);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0) {
+    RuntimeError::raise("Error reading input: %s", strerror(errno));
+  }
+  if (n == 0) {
+    m_eof = true;
+    return false;
+  }
+
+  m_end += n;
+  return true;
+}
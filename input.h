@@ -0,0 +1,82 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <cstdio>
+#include <cstddef>
+#include <vector>
+
+// An InputSource provides the Lexer with a window of raw input
+// bytes.  The lexer scans directly over the window, and asks the
+// source for more data when it reaches the end of the window.
+class InputSource {
+protected:
+  const char *m_begin, *m_end;   // window of currently available bytes
+  unsigned long m_base;          // offset of m_begin from start of input
+
+  // no value semantics
+  InputSource(const InputSource &);
+  InputSource &operator=(const InputSource &);
+
+public:
+  InputSource();
+  virtual ~InputSource();
+
+  const char *get_begin() const { return m_begin; }
+  const char *get_end() const { return m_end; }
+  unsigned long get_base() const { return m_base; }
+
+  // Make more input available.  Bytes from keep (which must be
+  // within the current window) to the end of the window are retained,
+  // but are moved so that the byte at keep is at get_begin().
+  // Returns false if there is no more input.
+  virtual bool more(const char *keep) = 0;
+
+  // Create an InputSource to read from given file: regular files
+  // are memory mapped, anything else (pipes, terminals) is read
+  // in large blocks.
+  static InputSource *create(FILE *in);
+};
+
+// InputSource for a memory-mapped regular file: the entire file
+// is available as a single window.
+class MmapInputSource : public InputSource {
+private:
+  void *m_map;
+  size_t m_size;
+
+public:
+  MmapInputSource(void *map, size_t size);
+  virtual ~MmapInputSource();
+
+  virtual bool more(const char *keep);
+};
+
+// InputSource for data which is already in memory.  The data is not
+// copied, and must remain valid for the lifetime of the InputSource.
+class MemoryInputSource : public InputSource {
+public:
+  MemoryInputSource(const char *data, size_t size);
+  virtual ~MemoryInputSource();
+
+  virtual bool more(const char *keep);
+};
+
+// InputSource which reads blocks of data from the file descriptor of
+// a FILE using read(2), taking whatever data is available (so input
+// from a pipe or terminal is processed without waiting for a full block).
+class BufferedInputSource : public InputSource {
+private:
+  FILE *m_in;
+  std::vector<char> m_buf;
+  bool m_eof;
+
+public:
+  enum { BLOCK_SIZE = 1 << 20 };
+
+  BufferedInputSource(FILE *in);
+  virtual ~BufferedInputSource();
+
+  virtual bool more(const char *keep);
+};
+
+#endif // INPUT_H
@@ -1,17 +1,24 @@
 #include <string>
-#include <map>
 #include <cassert>
 #include "cpputil.h"
-#include "token.h"
 #include "exceptions.h"
+#include "arith.h"
 #include "interp.h"
 
+ForkScheduler::~ForkScheduler() {
+}
+
 ////////////////////////////////////////////////////////////////////////
 // Interpreter implementation
 ////////////////////////////////////////////////////////////////////////
 
-Interpreter::Interpreter(Node *tree)
-  : m_tree(tree) {
+Interpreter::Interpreter(const FlatAst *ast, Environment *env)
+  : m_ast(ast)
+  , m_env(env)
+  , m_fork_depth(0)
+  , m_scheduler(nullptr)
+  , m_worker(0)
+  , m_assigns(nullptr) {
 }
 
 Interpreter::~Interpreter() {
@@ -19,98 +26,209 @@ Interpreter::~Interpreter() {
 
 long Interpreter::exec() {
   long result = -1;
-  Node *unit = m_tree;
 
-  while (unit) {
-    // first child is (E)xpression
-    Node *expr = unit->get_kid(0);
+  m_env->resolve_slots();
 
+  unsigned num_stmts = m_ast->get_num_statements();
+  for (unsigned i = 0; i < num_stmts; i++) {
     // evaluate the expression!
-    result = eval(expr);
-
-    // if there are more expressions, the next (U)nit
-    // is the third child
-    if (unit->get_num_kids() == 3) {
-      unit = unit->get_kid(2);
-    } else {
-      // no more expressions
-      unit = nullptr;
-    }
+    result = eval_statement(i);
   }
 
   return result;
 }
 
-long Interpreter::eval(Node *expr) {
-  // the number of children and the first child's tag will determine
-  // how to evaluate the expression
-  Node *first = expr->get_kid(0);
-  int num_kids = expr->get_num_kids();
-  int tag = first->get_tag();
-
-  if (num_kids == 1) {
-    // leaf expression (either an integer literal or identifier)
-    std::string lexeme = first->get_str();
-    if (tag == TOK_INTEGER_LITERAL) {
-      // convert lexeme to an integer value
-      return strtol(lexeme.c_str(), nullptr, 10);
-    } else {
-      // look up value of variable
-      assert(tag == TOK_IDENTIFIER);
-      std::map<std::string, long>::const_iterator i = m_vars.find(lexeme);
-      if (i == m_vars.end()) {
-        SemanticError::raise(expr->get_loc(), "Undefined variable '%s'", lexeme.c_str());
-      }
-      return i->second;
-    }
+long Interpreter::exec_statement(unsigned stmt) {
+  // the statement may refer to symbols which hadn't been seen yet
+  // when previous statements were executed
+  m_env->resolve_slots();
+  return eval_statement(stmt);
+}
+
+long Interpreter::eval_statement(unsigned stmt) {
+  unsigned begin = m_ast->get_statement(stmt), end = m_ast->get_statement_end(stmt);
+  if (m_fork_depth > 0 && end - begin >= 2 * FORK_MIN_NODES) {
+    return eval_tree(begin, end, 0);
   }
+  return eval(begin, end);
+}
 
-  // left and right operands follow
-  Node *left = expr->get_kid(1);
-  Node *right = expr->get_kid(2);
-
-  // Do the evaluation
-  switch (tag) {
-  case TOK_PLUS:
-    return eval(left) + eval(right);
-  case TOK_MINUS:
-    return eval(left) - eval(right);
-  case TOK_TIMES:
-    return eval(left) * eval(right);
-  case TOK_DIVIDE:
-    return eval(left) / eval(right);
-
-  case TOK_ASSIGN:
-    // in this case, the left operand is an identifier naming
-    // the variable
-    {
-      // get the variable name
-      std::string varname = left->get_str();
-      // evaluate the expression producing the value to be assigned
-      long rvalue = eval(right);
-      // store the value
-      m_vars[varname] = rvalue;
-      // result of the evaluation is the value assigned
-      return rvalue;
-    }
+void Interpreter::set_fork_join(unsigned max_depth, ForkScheduler *scheduler, unsigned worker,
+                                const std::vector<unsigned> *assigns) {
+  m_fork_depth = max_depth;
+  m_scheduler = scheduler;
+  m_worker = worker;
+  if (assigns == nullptr && max_depth > 0) {
+    count_assigns(*m_ast, m_own_assigns);
+    assigns = &m_own_assigns;
+  }
+  m_assigns = assigns;
+}
 
-  default:
-    RuntimeError::raise("Unknown operator: %d", tag);
+void Interpreter::run_fork_task(ForkTask *task, unsigned worker) {
+  const Interpreter *parent = task->parent;
+  Interpreter interp(parent->m_ast, parent->m_env);
+  interp.set_fork_join(parent->m_fork_depth, parent->m_scheduler, worker, parent->m_assigns);
+  try {
+    task->value = interp.eval_tree(task->begin, task->end, task->depth);
+  } catch (...) {
+    task->error = std::current_exception();
   }
+  task->done.store(true, std::memory_order_release);
 }
 
-////////////////////////////////////////////////////////////////////////
-// Interpreter API functions
-////////////////////////////////////////////////////////////////////////
+void Interpreter::count_assigns(const FlatAst &ast, std::vector<unsigned> &assigns) {
+  unsigned num_nodes = ast.get_num_nodes();
+  assigns.resize(num_nodes + 1);
+  assigns[0] = 0;
+  for (unsigned i = 0; i < num_nodes; i++) {
+    assigns[i + 1] = assigns[i] + (ast.get_op(i) == AST_ASSIGN);
+  }
+}
 
-Interpreter *interp_create(struct Node *tree) {
-  return new Interpreter(tree);
+// Apply a binary operator to the values of its operands
+inline long Interpreter::apply(unsigned node, long left, long right) const {
+  AstOp op = m_ast->get_op(node);
+  switch (op) {
+  case AST_ADD:
+    return arith::add(left, right);
+  case AST_SUB:
+    return arith::sub(left, right);
+  case AST_MUL:
+    return arith::mul(left, right);
+  case AST_DIV:
+    if (right == 0) {
+      EvaluationError::raise(m_ast->get_loc(node), "Division by zero");
+    }
+    return arith::div(left, right);
+  default:
+    RuntimeError::raise("Unknown operator: %d", int(op));
+  }
 }
 
-void interp_destroy(Interpreter *interp) {
-  delete interp;
+// Evaluate the expression stored in AST nodes begin..end-1.  Since the
+// nodes are in preorder, scanning them in order encounters the operands
+// in left to right evaluation order.  Operators and assignments are
+// pushed on a stack of evaluation frames when they are encountered,
+// and each time a leaf is evaluated its value is delivered to the
+// frame on top of the stack, completing as many frames as possible.
+long Interpreter::eval(unsigned begin, unsigned end) {
+  const unsigned char *ops = m_ast->get_ops();
+  const long *payloads = m_ast->get_payloads();
+  long *values = m_env->get_values();
+  unsigned char *defined = m_env->get_defined();
+
+  // value of the most recently evaluated subexpression
+  long value = 0;
+
+  m_stack.clear();
+
+  for (unsigned i = begin; i < end; i++) {
+    AstOp op = AstOp(ops[i]);
+
+    if (op == AST_LITERAL) {
+      value = payloads[i];
+    } else if (op == AST_VAR) {
+      // look up value of variable
+      unsigned slot = unsigned(payloads[i]);
+      if (!defined[slot]) {
+        m_env->undefined_variable(m_ast->get_loc(i), slot);
+      }
+      value = values[slot];
+    } else {
+      // operands follow
+      m_stack.push_back({ i, 0, 0 });
+      continue;
+    }
+
+    // deliver the value to the frames waiting for it
+    while (!m_stack.empty()) {
+      EvalFrame &frame = m_stack.back();
+      AstOp frame_op = AstOp(ops[frame.node]);
+
+      if (frame_op == AST_ASSIGN) {
+        // store the value: result of the evaluation is the value assigned
+        unsigned slot = unsigned(payloads[frame.node]);
+        values[slot] = value;
+        defined[slot] = 1;
+        m_stack.pop_back();
+        continue;
+      }
+
+      if (frame.state == 0) {
+        // left operand is done, right operand is next
+        frame.state = 1;
+        frame.lvalue = value;
+        break;
+      }
+
+      // Do the evaluation
+      value = apply(frame.node, frame.lvalue, value);
+      m_stack.pop_back();
+    }
+  }
+
+  assert(m_stack.empty());
+  return value;
 }
 
-long interp_exec(Interpreter *interp) {
-  return interp->exec();
+// Evaluate the expression stored in AST nodes begin..end-1, splitting
+// large operators between two threads.  An operator is only worth
+// splitting if both of its operands are large, so for a degenerate
+// (deep) tree the whole tree is evaluated by eval, and otherwise each
+// level of recursion at least halves the size of the smaller operand.
+// The value of the right operand isn't needed until the left operand
+// has been evaluated, and the subexpression has no assignments, so
+// evaluating the operands concurrently doesn't change the result.  If
+// both operands raise an error, the left operand's error is the one
+// that sequential evaluation would have raised.
+long Interpreter::eval_tree(unsigned begin, unsigned end, unsigned depth) {
+  // assignments of the value of the subexpression
+  unsigned expr = begin;
+  while (m_ast->get_op(expr) == AST_ASSIGN) {
+    expr++;
+  }
+
+  long value;
+  AstOp op = m_ast->get_op(expr);
+  unsigned right = FlatAst::is_binary(op) ? m_ast->get_right(expr) : FlatAst::NO_NODE;
+
+  if (right == FlatAst::NO_NODE || right - (expr + 1) < FORK_MIN_NODES || end - right < FORK_MIN_NODES) {
+    // not worth splitting
+    return eval(begin, end);
+  } else if ((*m_assigns)[end] != (*m_assigns)[expr]) {
+    // operands must be evaluated in order, but parts of them might be split
+    long lvalue = eval_tree(expr + 1, right, depth);
+    value = apply(expr, lvalue, eval_tree(right, end, depth));
+  } else if (depth >= m_fork_depth) {
+    return eval(begin, end);
+  } else {
+    // the task must be joined before returning, even if the left
+    // operand raises an error, since it refers to this stack frame
+    ForkTask rtask(this, right, end, depth + 1);
+    m_scheduler->fork(m_worker, &rtask);
+    long lvalue;
+    try {
+      lvalue = eval_tree(expr + 1, right, depth + 1);
+    } catch (...) {
+      m_scheduler->join(m_worker, &rtask);
+      throw;
+    }
+    m_scheduler->join(m_worker, &rtask);
+    if (rtask.error) {
+      std::rethrow_exception(rtask.error);
+    }
+    value = apply(expr, lvalue, rtask.value);
+  }
+
+  // the innermost assignment happens first
+  long *values = m_env->get_values();
+  unsigned char *defined = m_env->get_defined();
+  for (unsigned i = expr; i > begin; i--) {
+    unsigned slot = unsigned(m_ast->get_payload(i - 1));
+    values[slot] = value;
+    defined[slot] = 1;
+  }
+
+  return value;
 }
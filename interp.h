@@ -1,22 +1,110 @@
 #ifndef INTERP_H
 #define INTERP_H
 
-#include <map>
-#include "node.h"
+#include <vector>
+#include <string>
+#include <atomic>
+#include <exception>
+#include "ast.h"
+#include "env.h"
+
+class Interpreter;
+
+// The right operand of an operator, evaluated by another thread while
+// the forking thread evaluates the left operand (see set_fork_join)
+struct ForkTask {
+  const Interpreter *parent;
+  unsigned begin, end, depth;
+  long value;
+  std::exception_ptr error;
+  std::atomic<bool> done;
+
+  ForkTask(const Interpreter *parent_, unsigned begin_, unsigned end_, unsigned depth_)
+    : parent(parent_), begin(begin_), end(end_), depth(depth_), value(0), done(false) { }
+};
+
+// Runs ForkTasks on a pool of worker threads.  fork makes a task
+// available to the other workers, and join waits until it is done,
+// running it if no other worker has taken it (and running other work
+// while waiting for a worker which has).  Tasks are run by calling
+// Interpreter::run_fork_task.
+class ForkScheduler {
+public:
+  virtual ~ForkScheduler();
+
+  virtual void fork(unsigned worker, ForkTask *task) = 0;
+  virtual void join(unsigned worker, ForkTask *task) = 0;
+};
 
 class Interpreter {
 private:
-  Node *m_tree;
-  std::map<std::string, long> m_vars;
+  // An operator or assignment whose operands are being evaluated:
+  // state is the number of operands evaluated so far, and lvalue is
+  // the value of the left operand once it has been evaluated.
+  struct EvalFrame {
+    unsigned node;
+    int state;
+    long lvalue;
+  };
+
+  const FlatAst *m_ast;
+  Environment *m_env;
+  std::vector<EvalFrame> m_stack;
+
+  // fork-join evaluation (see set_fork_join)
+  unsigned m_fork_depth;
+  ForkScheduler *m_scheduler;
+  unsigned m_worker;
+  const std::vector<unsigned> *m_assigns;
+  std::vector<unsigned> m_own_assigns;
 
 public:
-  Interpreter(Node *tree);
+  Interpreter(const FlatAst *ast, Environment *env);
   ~Interpreter();
 
   long exec();
 
+  // Execute a single statement of the AST, for executing statements
+  // one at a time as they are parsed.  Returns the value of the statement.
+  long exec_statement(unsigned stmt);
+
+  // Evaluate a single statement without first making sure there is
+  // a slot for every symbol.  Since the Environment isn't modified
+  // except for the variables the statement assigns, Interpreters in
+  // different threads can evaluate statements which don't refer to
+  // the same variables concurrently.
+  long eval_statement(unsigned stmt);
+
+  // Evaluate large subexpressions in parallel: if neither operand of an
+  // operator is smaller than FORK_MIN_NODES nodes, and the operator's
+  // subexpression has no assignments, its right operand is forked as
+  // a task on the scheduler's pool while this thread evaluates the left
+  // operand.  Operands are split this way up to max_depth levels deep
+  // (0 disables fork-join evaluation).  worker is the scheduler's id of
+  // the thread using the Interpreter.  If several Interpreters evaluate
+  // the same AST, one can share its assignment counts (see
+  // count_assigns) with the others.
+  void set_fork_join(unsigned max_depth, ForkScheduler *scheduler, unsigned worker,
+                     const std::vector<unsigned> *assigns = nullptr);
+
+  // Evaluate a forked operand on given worker thread, storing its
+  // value or error in the task, then marking it as done
+  static void run_fork_task(ForkTask *task, unsigned worker);
+
+  // Count the assignment nodes preceding each node of an AST:
+  // assigns[i] is the number of assignments among nodes 0..i-1.
+  static void count_assigns(const FlatAst &ast, std::vector<unsigned> &assigns);
+
+  // (tests can define PFX_FORK_MIN_NODES to split small expressions)
+#ifndef PFX_FORK_MIN_NODES
+#  define PFX_FORK_MIN_NODES (1 << 14)
+#endif
+  static const unsigned FORK_MIN_NODES = PFX_FORK_MIN_NODES;
+
 private:
-  long eval(Node *expr);
+  long eval(unsigned begin, unsigned end);
+  long eval_tree(unsigned begin, unsigned end, unsigned depth);
+  long apply(unsigned node, long left, long right) const;
 };
 
 #endif // INTERP_H
@@ -0,0 +1,464 @@
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cassert>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "exceptions.h"
+#include "jit.h"
+
+#if defined(__x86_64__)
+#  define JIT_X86_64 1
+#endif
+
+namespace {
+
+// Signature of generated code.  Returns 0 on success (with the value
+// of the program stored in *result), or 1 + the index of the
+// instruction which caused an error.
+typedef unsigned long (*JitFn)(long *values, unsigned char *defined, long *spill, long *result);
+
+#ifdef JIT_X86_64
+
+////////////////////////////////////////////////////////////////////////
+// x86-64 instruction encoding
+////////////////////////////////////////////////////////////////////////
+
+enum Reg {
+  RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+  R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Register usage in generated code.  The arguments are moved out
+// of rdx and rcx, since idiv needs rdx, and rcx is used for the stack.
+// rax and rdx are scratch registers.
+const Reg VALUES = RDI;
+const Reg DEFINED = RSI;
+const Reg SPILL = R9;
+const Reg RESULT = R10;
+
+// registers holding the bottom of the VM stack
+const Reg s_stack_regs[] = { RBX, R12, R13, R14, R15, RCX, R8, R11 };
+const unsigned NUM_STACK_REGS = sizeof(s_stack_regs) / sizeof(s_stack_regs[0]);
+
+// callee-saved registers which must be preserved
+const Reg s_saved_regs[] = { RBX, R12, R13, R14, R15 };
+const unsigned NUM_SAVED_REGS = sizeof(s_saved_regs) / sizeof(s_saved_regs[0]);
+
+// Location of a VM stack element: either a register, or a memory
+// location in the spill area
+struct Operand {
+  bool is_reg;
+  Reg reg;
+  int32_t disp;   // offset from SPILL
+};
+
+Operand stack_operand(unsigned index) {
+  if (index < NUM_STACK_REGS) {
+    return { true, s_stack_regs[index], 0 };
+  }
+  return { false, RAX, int32_t((index - NUM_STACK_REGS) * sizeof(long)) };
+}
+
+// Appends encoded instructions to a buffer.  Only the handful of
+// instruction forms needed by the code generator are supported:
+// memory operands are always [base + disp32], where the base is
+// not rsp or r12 (which would require a SIB byte).
+class Emitter {
+private:
+  std::vector<unsigned char> &m_buf;
+
+public:
+  Emitter(std::vector<unsigned char> &buf) : m_buf(buf) { }
+
+  size_t get_pos() const { return m_buf.size(); }
+
+  void byte(unsigned b) { m_buf.push_back((unsigned char) b); }
+
+  void imm32(int32_t v) {
+    uint32_t u = uint32_t(v);
+    for (int i = 0; i < 4; i++) {
+      byte((u >> (i * 8)) & 0xFF);
+    }
+  }
+
+  void imm64(int64_t v) {
+    uint64_t u = uint64_t(v);
+    for (int i = 0; i < 8; i++) {
+      byte((u >> (i * 8)) & 0xFF);
+    }
+  }
+
+  void rex(bool w, unsigned reg, unsigned rm) {
+    unsigned prefix = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+    if (prefix != 0x40) {
+      byte(prefix);
+    }
+  }
+
+  void opcode(unsigned opc) {
+    if (opc > 0xFF) {
+      byte(opc >> 8);
+    }
+    byte(opc & 0xFF);
+  }
+
+  void modrm_reg(unsigned reg, unsigned rm) {
+    byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+  }
+
+  void modrm_mem(unsigned reg, unsigned base, int32_t disp) {
+    assert((base & 7) != RSP);
+    byte(0x80 | ((reg & 7) << 3) | (base & 7));
+    imm32(disp);
+  }
+
+  // 64 bit operation with register operands: opc reg, rm
+  void op_rr(unsigned opc, unsigned reg, unsigned rm) {
+    rex(true, reg, rm);
+    opcode(opc);
+    modrm_reg(reg, rm);
+  }
+
+  // 64 bit operation with a memory operand: opc reg, [base + disp]
+  void op_rm(unsigned opc, unsigned reg, unsigned base, int32_t disp) {
+    rex(true, reg, base);
+    opcode(opc);
+    modrm_mem(reg, base, disp);
+  }
+
+  void mov_rr(Reg dst, Reg src) { op_rr(0x8B, dst, src); }
+  void load(Reg dst, Reg base, int32_t disp) { op_rm(0x8B, dst, base, disp); }
+  void store(Reg base, int32_t disp, Reg src) { op_rm(0x89, src, base, disp); }
+
+  void mov_imm(Reg dst, long value) {
+    if (value >= INT32_MIN && value <= INT32_MAX) {
+      // mov r/m64, imm32 (sign extended)
+      rex(true, 0, dst);
+      byte(0xC7);
+      modrm_reg(0, dst);
+      imm32(int32_t(value));
+    } else {
+      // mov r64, imm64
+      rex(true, 0, dst);
+      byte(0xB8 + (dst & 7));
+      imm64(value);
+    }
+  }
+
+  // Move an operand into a register (if it isn't already in one),
+  // and back again
+  Reg get(const Operand &op, Reg scratch) {
+    if (op.is_reg) {
+      return op.reg;
+    }
+    load(scratch, SPILL, op.disp);
+    return scratch;
+  }
+
+  void put(const Operand &op, Reg src) {
+    if (op.is_reg) {
+      if (op.reg != src) {
+        mov_rr(op.reg, src);
+      }
+    } else {
+      store(SPILL, op.disp, src);
+    }
+  }
+
+  // opc dst, src where the opcode takes its source as r/m64
+  void alu(unsigned opc, Reg dst, const Operand &src) {
+    if (src.is_reg) {
+      op_rr(opc, dst, src.reg);
+    } else {
+      op_rm(opc, dst, SPILL, src.disp);
+    }
+  }
+
+  // F7 /ext (neg, idiv) and 83 /7 (cmp with imm8) on an operand
+  void group(unsigned opc, unsigned ext, const Operand &op) {
+    if (op.is_reg) {
+      op_rr(opc, ext, op.reg);
+    } else {
+      op_rm(opc, ext, SPILL, op.disp);
+    }
+  }
+
+  void cmp_imm8(const Operand &op, int imm) {
+    group(0x83, 7, op);
+    byte(imm & 0xFF);
+  }
+
+  // cmp byte [base + disp], imm8
+  void cmp_byte(Reg base, int32_t disp, int imm) {
+    rex(false, 0, base);
+    byte(0x80);
+    modrm_mem(7, base, disp);
+    byte(imm & 0xFF);
+  }
+
+  // mov byte [base + disp], imm8
+  void mov_byte(Reg base, int32_t disp, int imm) {
+    rex(false, 0, base);
+    byte(0xC6);
+    modrm_mem(0, base, disp);
+    byte(imm & 0xFF);
+  }
+
+  void push(Reg r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+  void pop(Reg r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+  void ret() { byte(0xC3); }
+  void cqo() { byte(0x48); byte(0x99); }
+
+  // mov eax, imm32 (zero extended to rax)
+  void mov_eax(uint32_t value) { byte(0xB8); imm32(int32_t(value)); }
+
+  // Jumps have 32 bit displacements, and return the position of the
+  // displacement, so that it can be patched once the target is known
+  size_t jcc(unsigned cc) { byte(0x0F); byte(0x80 + cc); imm32(0); return get_pos() - 4; }
+  size_t jmp() { byte(0xE9); imm32(0); return get_pos() - 4; }
+
+  void patch(size_t disp_pos, size_t target) {
+    int32_t rel = int32_t(long(target) - long(disp_pos + 4));
+    memcpy(&m_buf[disp_pos], &rel, 4);
+  }
+};
+
+// condition codes
+const unsigned CC_E = 0x4;
+const unsigned CC_NE = 0x5;
+
+#endif // JIT_X86_64
+
+} // end anonymous namespace
+
+////////////////////////////////////////////////////////////////////////
+// Jit implementation
+////////////////////////////////////////////////////////////////////////
+
+Jit::Jit(Environment *env)
+  : m_env(env)
+  , m_code(nullptr)
+  , m_mem(nullptr)
+  , m_mem_size(0) {
+}
+
+Jit::~Jit() {
+  if (m_mem != nullptr) {
+    munmap(m_mem, m_mem_size);
+  }
+}
+
+bool Jit::is_supported() {
+#ifdef JIT_X86_64
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Jit::compile(const Bytecode &code) {
+  if (!is_supported()) {
+    RuntimeError::raise("JIT compilation is not supported on this platform");
+  }
+
+  // the environment must have slots for the variables the code uses
+  m_env->resolve_slots();
+
+  m_code = &code;
+  generate(code);
+  install();
+}
+
+long Jit::run() {
+  JitFn fn = reinterpret_cast<JitFn>(m_mem);
+
+  // symbols may have been added since the code was compiled
+  m_env->resolve_slots();
+
+  long result = 0;
+  unsigned long status = fn(m_env->get_values(), m_env->get_defined(), m_spill.data(), &result);
+  if (status != 0) {
+    unsigned pc = unsigned(status - 1);
+    const Insn &insn = m_code->get_code()[pc];
+    if (insn.op == OP_LOAD) {
+      m_env->undefined_variable(m_code->get_loc(pc), unsigned(insn.arg));
+    }
+    EvaluationError::raise(m_code->get_loc(pc), "Division by zero");
+  }
+  return result;
+}
+
+// Generate machine code for the compiled bytecode.  The stack depth
+// at each instruction is known at compile time, so each VM stack
+// element is assigned a fixed location, and every bytecode
+// instruction is translated into a few machine instructions operating
+// directly on those locations.
+void Jit::generate(const Bytecode &code) {
+#ifdef JIT_X86_64
+  m_buf.clear();
+  Emitter e(m_buf);
+
+  // stack elements which don't fit in registers are spilled
+  unsigned max_depth = code.get_max_depth();
+  m_spill.resize(max_depth > NUM_STACK_REGS ? max_depth - NUM_STACK_REGS : 1);
+
+  // error exits to generate: (position of jump displacement, bytecode pc)
+  std::vector<std::pair<size_t, unsigned>> exits;
+  std::vector<size_t> to_epilogue;
+
+  // prologue
+  for (unsigned i = 0; i < NUM_SAVED_REGS; i++) {
+    e.push(s_saved_regs[i]);
+  }
+  e.mov_rr(SPILL, RDX);
+  e.mov_rr(RESULT, RCX);
+
+  const Insn *insns = code.get_code();
+  unsigned num_insns = code.get_num_insns();
+  unsigned depth = 0;
+
+  for (unsigned pc = 0; pc < num_insns; pc++) {
+    const Insn &insn = insns[pc];
+
+    // variable offsets must fit in a 32 bit displacement
+    int32_t slot_disp = 0;
+    if (insn.op == OP_LOAD || insn.op == OP_STORE) {
+      if (insn.arg > long(INT32_MAX / sizeof(long))) {
+        RuntimeError::raise("Too many variables for JIT compilation");
+      }
+      slot_disp = int32_t(insn.arg * long(sizeof(long)));
+    }
+
+    switch (insn.op) {
+    case OP_PUSH: {
+      Operand dst = stack_operand(depth++);
+      if (dst.is_reg) {
+        e.mov_imm(dst.reg, insn.arg);
+      } else {
+        e.mov_imm(RAX, insn.arg);
+        e.put(dst, RAX);
+      }
+      break;
+    }
+
+    case OP_LOAD: {
+      e.cmp_byte(DEFINED, int32_t(insn.arg), 0);
+      exits.push_back({ e.jcc(CC_E), pc });
+      Operand dst = stack_operand(depth++);
+      Reg r = dst.is_reg ? dst.reg : RAX;
+      e.load(r, VALUES, slot_disp);
+      e.put(dst, r);
+      break;
+    }
+
+    case OP_STORE: {
+      Reg r = e.get(stack_operand(depth - 1), RAX);
+      e.store(VALUES, slot_disp, r);
+      e.mov_byte(DEFINED, int32_t(insn.arg), 1);
+      break;
+    }
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL: {
+      Operand left = stack_operand(depth - 2);
+      Operand right = stack_operand(depth - 1);
+      depth--;
+      Reg r = e.get(left, RAX);
+      unsigned opc = (insn.op == OP_ADD) ? 0x03 : (insn.op == OP_SUB) ? 0x2B : 0x0FAF;
+      e.alu(opc, r, right);
+      e.put(left, r);
+      break;
+    }
+
+    case OP_DIV: {
+      Operand left = stack_operand(depth - 2);
+      Operand right = stack_operand(depth - 1);
+      depth--;
+      Reg l = e.get(left, RAX);
+      if (l != RAX) {
+        e.mov_rr(RAX, l);
+      }
+      // division by zero is an error
+      e.cmp_imm8(right, 0);
+      exits.push_back({ e.jcc(CC_E), pc });
+      // division by -1 is negation (idiv would trap on LONG_MIN / -1)
+      e.cmp_imm8(right, -1);
+      size_t not_neg = e.jcc(CC_NE);
+      e.group(0xF7, 3, { true, RAX, 0 });
+      size_t done = e.jmp();
+      e.patch(not_neg, e.get_pos());
+      e.cqo();
+      e.group(0xF7, 7, right);
+      e.patch(done, e.get_pos());
+      e.put(left, RAX);
+      break;
+    }
+
+    case OP_POP:
+      depth--;
+      break;
+
+    case OP_HALT: {
+      Reg r = e.get(stack_operand(depth - 1), RAX);
+      e.store(RESULT, 0, r);
+      e.byte(0x31); e.byte(0xC0);   // xor eax, eax
+      to_epilogue.push_back(e.jmp());
+      break;
+    }
+
+    default:
+      RuntimeError::raise("Unknown opcode: %d", int(insn.op));
+    }
+  }
+
+  // error exits return the index of the faulting instruction
+  for (auto i = exits.begin(); i != exits.end(); ++i) {
+    e.patch(i->first, e.get_pos());
+    e.mov_eax(i->second + 1);
+    to_epilogue.push_back(e.jmp());
+  }
+
+  // epilogue
+  for (auto i = to_epilogue.begin(); i != to_epilogue.end(); ++i) {
+    e.patch(*i, e.get_pos());
+  }
+  for (unsigned i = NUM_SAVED_REGS; i > 0; i--) {
+    e.pop(s_saved_regs[i - 1]);
+  }
+  e.ret();
+#else
+  (void) code;
+#endif
+}
+
+// Copy the generated code to executable memory.  The memory is never
+// writable and executable at the same time.
+void Jit::install() {
+  long page_size = sysconf(_SC_PAGESIZE);
+  size_t size = (m_buf.size() + size_t(page_size) - 1) & ~size_t(page_size - 1);
+
+  if (m_mem != nullptr && m_mem_size >= size) {
+    // reuse the existing memory
+    if (mprotect(m_mem, m_mem_size, PROT_READ | PROT_WRITE) != 0) {
+      RuntimeError::raise("Could not make JIT code writable: %s", strerror(errno));
+    }
+  } else {
+    if (m_mem != nullptr) {
+      munmap(m_mem, m_mem_size);
+      m_mem = nullptr;
+    }
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      RuntimeError::raise("Could not allocate memory for JIT code: %s", strerror(errno));
+    }
+    m_mem = mem;
+    m_mem_size = size;
+  }
+
+  memcpy(m_mem, m_buf.data(), m_buf.size());
+  if (mprotect(m_mem, m_mem_size, PROT_READ | PROT_EXEC) != 0) {
+    RuntimeError::raise("Could not make JIT code executable: %s", strerror(errno));
+  }
+}
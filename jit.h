@@ -0,0 +1,48 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <vector>
+#include <cstddef>
+#include "bytecode.h"
+#include "env.h"
+
+// JIT compiler translating Bytecode into native x86-64 code.  The
+// VM's stack is mapped onto registers (with stack positions beyond the
+// available registers spilled to memory), and variables are accessed
+// directly in the Environment's flat arrays.  Checks for undefined
+// variables and division by zero branch to out-of-line exits which
+// return the index of the faulting instruction, so that run() can
+// raise the same errors as the other engines.
+class Jit {
+private:
+  Environment *m_env;
+  const Bytecode *m_code;           // code which was compiled
+  void *m_mem;                      // executable memory
+  size_t m_mem_size;
+  std::vector<unsigned char> m_buf; // machine code being generated
+  std::vector<long> m_spill;        // spilled stack values
+
+  // no value semantics
+  Jit(const Jit &);
+  Jit &operator=(const Jit &);
+
+public:
+  Jit(Environment *env);
+  ~Jit();
+
+  // Returns true if native code can be generated on this platform
+  static bool is_supported();
+
+  // Translate code to native code.  The Bytecode object must remain
+  // valid until run() is called, since it is used to report errors.
+  void compile(const Bytecode &code);
+
+  // Execute the most recently compiled code
+  long run();
+
+private:
+  void generate(const Bytecode &code);
+  void install();
+};
+
+#endif // JIT_H
@@ -1,149 +1,282 @@
-#include <cctype>
+#include <cstring>
+#include <climits>
 #include <string>
 #include "cpputil.h"
 #include "token.h"
 #include "exceptions.h"
+#include "scan.h"
+#include "srcmgr.h"
 #include "lexer.h"
 
 ////////////////////////////////////////////////////////////////////////
 // Lexer implementation
 ////////////////////////////////////////////////////////////////////////
 
-Lexer::Lexer(FILE *in, const std::string &filename)
-  : m_in(in)
-  , m_next(nullptr)
-  , m_filename(filename)
-  , m_line(1)
-  , m_col(1)
-  , m_eof(false) {
+Lexer::Lexer(FILE *in, const std::string &filename, SymbolTable *symtab)
+  : Lexer(InputSource::create(in), filename, symtab) {
+}
+
+Lexer::Lexer(InputSource *src_to_adopt, const std::string &filename, SymbolTable *symtab)
+  : m_src(src_to_adopt)
+  , m_pos(src_to_adopt->get_begin())
+  , m_tok_start(m_pos)
+  , m_blk(nullptr)
+  , m_blk_end(nullptr)
+  , m_have_next(false)
+  , m_src_id(SourceManager::get_instance().add_source(filename))
+  , m_symtab(symtab) {
+}
+
+Lexer::Lexer(InputSource *src_to_adopt, SymbolTable *symtab)
+  : m_src(src_to_adopt)
+  , m_pos(src_to_adopt->get_begin())
+  , m_tok_start(m_pos)
+  , m_blk(nullptr)
+  , m_blk_end(nullptr)
+  , m_have_next(false)
+  , m_src_id(Location::UNREGISTERED_SRC)
+  , m_symtab(symtab) {
 }
 
 Lexer::~Lexer() {
-  if (m_next != nullptr) {
-    delete m_next;
-  }
+  publish_line_starts();
+  delete m_src;
 }
 
-Node *Lexer::next() {
+Token Lexer::next() {
   fill();
-  if (m_next == nullptr)
+  if (m_next.kind == TOK_EOF)
     SyntaxError::raise(get_current_loc(), "Unexpected end of input");
-  Node *tok = m_next;
-  m_next = nullptr;
-  return tok;
+  m_have_next = false;
+  return m_next;
 }
 
-Node *Lexer::peek() {
+// Return the next token without consuming it.  At the end of input,
+// the returned token's kind is TOK_EOF.
+Token Lexer::peek() {
   fill();
   return m_next;
 }
 
 Location Lexer::get_current_loc() const {
-  return Location(m_filename, m_line, m_col);
+  return Location(m_src_id, get_offset(m_pos));
 }
 
-// Read the next character of input, returning -1 (and setting m_eof to true)
-// if the end of input has been reached.
-int Lexer::read() {
-  if (m_eof) {
-    return -1;
+Location Lexer::get_loc(const Token &tok) const {
+  return Location(m_src_id, tok.offset);
+}
+
+void Lexer::discard_line_info() {
+  publish_line_starts();
+  if (m_src_id == Location::UNREGISTERED_SRC) {
+    return;
   }
-  int c = fgetc(m_in);
-  if (c < 0) {
-    m_eof = true;
-  } else if (c == '\n') {
-    m_col = 1;
-    m_line++;
-  } else {
-    m_col++;
+  unsigned long offset = m_have_next ? m_next.offset : get_offset(m_pos);
+  SourceManager::get_instance().discard_line_starts(m_src_id, offset);
+}
+
+// The start of each line is recorded locally as the input is scanned,
+// and given to the SourceManager (which must lock it) all at once: when
+// the end of the input window is reached, when line information is
+// discarded, and when the Lexer is destroyed.  Locations in the input
+// read so far can therefore be used once the Lexer has reached the end
+// of the input or has been destroyed.  If the input isn't registered
+// with the SourceManager, the line starts are just dropped.
+void Lexer::publish_line_starts() {
+  if (!m_line_starts.empty()) {
+    if (m_src_id != Location::UNREGISTERED_SRC) {
+      SourceManager::get_instance().add_line_starts(m_src_id, m_line_starts);
+    }
+    m_line_starts.clear();
   }
-  return c;
 }
 
-// "Unread" a character.  Useful for when reading a character indicates
-// that the current token has ended and the next one has begun.
-void Lexer::unread(int c) {
-  ungetc(c, m_in);
-  m_col--;
+// Ask the input source for more data once the current window has
+// been consumed.  The part of the token currently being read is
+// retained.  Returns false if there is no more input.
+bool Lexer::refill() {
+  publish_line_starts();
+
+  // the window is about to change, so the classified block is stale
+  m_blk = m_blk_end = nullptr;
+
+  bool more = m_src->more(m_tok_start);
+  m_pos = m_src->get_begin() + (m_pos - m_tok_start);
+  m_tok_start = m_src->get_begin();
+  return more;
 }
 
 void Lexer::fill() {
-  if (!m_eof && !m_next) {
+  if (!m_have_next) {
     m_next = read_token();
+    m_have_next = true;
   }
 }
 
-Node *Lexer::read_token() {
-  int c, line = -1, col = -1;
+Token Lexer::read_token() {
+  skip_space();
 
-  // skip whitespace characters until a non-whitespace character is read
-  for (;;) {
-    line = m_line;
-    col = m_col;
-    c = read();
-    if (c < 0 || !isspace(c)) {
-      break;
-    }
-  }
+  m_tok_start = m_pos;
 
-  if (c < 0) {
+  if (m_pos == m_src->get_end()) {
     // reached end of file
-    return nullptr;
+    return token_create(TOK_EOF);
   }
 
-  std::string lexeme;
-  lexeme.push_back(char(c));
+  int c = (unsigned char) *m_pos;
+
+  // the block containing the first character has already been
+  // classified (by skip_space), so use its bitmaps to determine
+  // whether it starts an identifier or integer literal
+  uint64_t bit = uint64_t(1) << classify_block(m_pos, m_src->get_end());
 
-  if (isalpha(c)) {
-    return read_continued_token(TOK_IDENTIFIER, lexeme, line, col, isalpha);
-  } else if (isdigit(c)) {
-    return read_continued_token(TOK_INTEGER_LITERAL, lexeme, line, col, isdigit);
+  if (m_blk_bits.bits[scan::CLASS_ALPHA] & bit) {
+    Token tok = read_continued_token(TOK_IDENTIFIER, scan::CLASS_ALPHA);
+    tok.sym = int(m_symtab->intern(tok.lexeme, tok.len));
+    return tok;
+  } else if (m_blk_bits.bits[scan::CLASS_DIGIT] & bit) {
+    Token tok = read_continued_token(TOK_INTEGER_LITERAL, scan::CLASS_DIGIT);
+    tok.value = literal_value(tok);
+    return tok;
   } else {
+    // all other tokens are a single character
+    m_pos++;
+
     switch (c) {
     case '+':
-      return token_create(TOK_PLUS, lexeme, line, col);
+      return token_create(TOK_PLUS);
     case '-':
-      return token_create(TOK_MINUS, lexeme, line, col);
+      return token_create(TOK_MINUS);
     case '*':
-      return token_create(TOK_TIMES, lexeme, line, col);
+      return token_create(TOK_TIMES);
     case '/':
-      return token_create(TOK_DIVIDE, lexeme, line, col);
+      return token_create(TOK_DIVIDE);
     case ';':
-      return token_create(TOK_SEMICOLON, lexeme, line, col);
+      return token_create(TOK_SEMICOLON);
     case '=':
-      return token_create(TOK_ASSIGN, lexeme, line, col);
+      return token_create(TOK_ASSIGN);
     default:
       {
-        Location pos(m_filename, line, col);
+        Location pos(m_src_id, get_offset(m_tok_start));
         SyntaxError::raise(pos,"Unrecognized character '%c'", c);
       }
     }
   } 
 }
 
+// Skip whitespace until a non-whitespace character or the end of
+// input is reached, recording the start of each new line.
+void Lexer::skip_space() {
+  for (;;) {
+    const char *end = m_src->get_end();
+    while (m_pos < end) {
+      unsigned k = classify_block(m_pos, end);
+
+      // find the number of whitespace characters n starting
+      // at the current position, and the newlines among them
+      uint64_t nonspace = ~m_blk_bits.bits[scan::CLASS_SPACE] >> k;
+      unsigned n = (nonspace != 0) ? unsigned(__builtin_ctzll(nonspace)) : scan::BLOCK_SIZE - k;
+      uint64_t newlines = m_blk_bits.bits[scan::CLASS_NEWLINE] >> k;
+      if (n < 64) {
+        newlines &= (uint64_t(1) << n) - 1;
+      }
+
+      if (newlines != 0) {
+        unsigned long offset = get_offset(m_pos);
+        while (newlines != 0) {
+          // the next line starts after the newline character
+          m_line_starts.push_back(offset + __builtin_ctzll(newlines) + 1);
+          newlines &= newlines - 1;
+        }
+      }
+      m_pos += n;
+
+      if (nonspace != 0) {
+        break;
+      }
+    }
+
+    m_tok_start = m_pos;
+    if (m_pos < end || !refill()) {
+      return;
+    }
+  }
+}
+
 // Read the continuation of a (possibly) multi-character token, such as
-// an identifier or integer literal.  pred is a pointer to a predicate
-// function to determine which characters are valid continuations.
-Node *Lexer::read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int)) {
-  std::string lexeme(lexeme_start);
+// an identifier or integer literal.  cls is the class of characters
+// which are valid continuations.
+Token Lexer::read_continued_token(enum TokenKind kind, scan::CharClass cls) {
   for (;;) {
-    int c = read();
-    if (c >= 0 && pred(c)) {
-      // token has finished
-      lexeme.push_back(char(c));
-    } else {
-      if (c >= 0) {
-        unread(c);
+    const char *end = m_src->get_end();
+    while (m_pos < end) {
+      unsigned k = classify_block(m_pos, end);
+      uint64_t nonmember = ~m_blk_bits.bits[cls] >> k;
+      if (nonmember != 0) {
+        m_pos += __builtin_ctzll(nonmember);
+        break;
       }
-      return token_create(kind, lexeme, line, col);
+      m_pos += scan::BLOCK_SIZE - k;
+    }
+
+    if (m_pos < end || !refill()) {
+      // token has finished
+      return token_create(kind);
     }
   }
 }
 
-// Helper function to create a Node object to represent a token.
-Node *Lexer::token_create(enum TokenKind kind, const std::string &lexeme, int line, int col) {
-  Node *token = new Node(kind, lexeme);
-  Location source_info(m_filename, line, col);
-  token->set_loc(source_info);
+// Make sure that the bitmaps in m_blk_bits describe the input at p,
+// classifying a new block starting at p if they don't.  Returns the
+// index of p within the classified block.  If there are fewer than
+// BLOCK_SIZE bytes left in the window, the block is padded with NUL
+// characters, which aren't a member of any class.
+unsigned Lexer::classify_block(const char *p, const char *end) {
+  if (p >= m_blk && p < m_blk_end) {
+    return unsigned(p - m_blk);
+  }
+
+  if (end - p >= long(scan::BLOCK_SIZE)) {
+    scan::classify(p, m_blk_bits);
+  } else {
+    char padded[scan::BLOCK_SIZE] = { 0 };
+    memcpy(padded, p, size_t(end - p));
+    scan::classify(padded, m_blk_bits);
+  }
+  m_blk = p;
+  m_blk_end = p + scan::BLOCK_SIZE;
+  return 0;
+}
+
+// Convert the lexeme of an integer literal token to its value,
+// reporting an error if the value isn't representable as a long.
+long Lexer::literal_value(const Token &tok) const {
+  long value = 0;
+  for (unsigned i = 0; i < tok.len; i++) {
+    int digit = tok.lexeme[i] - '0';
+    if (value > (LONG_MAX - digit) / 10) {
+      SyntaxError::raise(get_loc(tok), "Integer literal '%.*s' is out of range", int(tok.len), tok.lexeme);
+    }
+    value = value * 10 + digit;
+  }
+  return value;
+}
+
+// Get the offset from the beginning of the input of given position
+// in the input window.
+unsigned long Lexer::get_offset(const char *p) const {
+  return m_src->get_base() + (unsigned long) (p - m_src->get_begin());
+}
+
+// Helper function to create a Token whose lexeme is the input
+// from the start of the current token to the current position.
+Token Lexer::token_create(enum TokenKind kind) {
+  Token token;
+  token.kind = kind;
+  token.lexeme = m_tok_start;
+  token.len = unsigned(m_pos - m_tok_start);
+  token.offset = get_offset(m_tok_start);
+  token.value = 0;
+  token.sym = -1;
   return token;
 }
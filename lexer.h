@@ -2,33 +2,63 @@
 #define LEXER_H
 
 #include <cstdio>
+#include <string>
+#include <vector>
 #include "token.h"
-#include "node.h"
+#include "location.h"
+#include "input.h"
+#include "scan.h"
+#include "symtab.h"
 
 class Lexer {
 private:
-  FILE *m_in;
-  Node *m_next;
-  std::string m_filename;
-  int m_line, m_col;
-  bool m_eof;
+  InputSource *m_src;
+  const char *m_pos;        // current position in input window
+  const char *m_tok_start;  // start of token currently being read
+  const char *m_blk;        // start of block described by m_blk_bits
+  const char *m_blk_end;
+  scan::BlockBits m_blk_bits;
+  Token m_next;
+  bool m_have_next;
+  unsigned m_src_id;         // source id assigned by the SourceManager
+  std::vector<unsigned long> m_line_starts;  // not yet given to the SourceManager
+  SymbolTable *m_symtab;     // identifiers are interned here
 
 public:
-  Lexer(FILE *in, const std::string &filename);
+  Lexer(FILE *in, const std::string &filename, SymbolTable *symtab);
+  Lexer(InputSource *src_to_adopt, const std::string &filename, SymbolTable *symtab);
+
+  // Read input without registering it with the SourceManager, so
+  // the Lexer uses no global state.  The source id of the Locations
+  // of tokens is Location::UNREGISTERED_SRC: the caller must compute
+  // line numbers from their offsets itself.
+  Lexer(InputSource *src_to_adopt, SymbolTable *symtab);
   ~Lexer();
 
-  Node *next();
-  Node *peek();
+  Token next();
+  Token peek();
+
+  // Id of the input source, as assigned by the SourceManager
+  // (Location::UNREGISTERED_SRC if it isn't registered)
+  unsigned get_src_id() const { return m_src_id; }
 
   Location get_current_loc() const;
+  Location get_loc(const Token &tok) const;
+
+  // Discard line information for input preceding the next token
+  void discard_line_info();
 
 private:
-  int read();
-  void unread(int c);
+  void publish_line_starts();
+  bool refill();
   void fill();
-  Node *read_token();
-  Node *read_continued_token(enum TokenKind kind, const std::string &lexeme_start, int line, int col, int (*pred)(int));
-  Node *token_create(enum TokenKind kind, const std::string &lexeme, int line, int col);
+  Token read_token();
+  void skip_space();
+  Token read_continued_token(enum TokenKind kind, scan::CharClass cls);
+  unsigned classify_block(const char *p, const char *end);
+  long literal_value(const Token &tok) const;
+  unsigned long get_offset(const char *p) const;
+  Token token_create(enum TokenKind kind);
 };
 
 #endif // LEXER_H
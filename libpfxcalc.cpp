@@ -0,0 +1,326 @@
+#include <cstring>
+#include <new>
+#include <algorithm>
+#include <memory>
+#include "exceptions.h"
+#include "input.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+#include "fold.h"
+#include "bytecode.h"
+#include "env.h"
+#include "vm.h"
+#include "incremental.h"
+#include "pfxcalc.h"
+
+// A compiled program.  The program text isn't registered with the
+// SourceManager (so compiling uses no global state): error locations
+// are computed from the program's own line table.
+struct pfx_program {
+  SymbolTable symtab;
+  Bytecode code;
+  std::vector<unsigned long> line_starts;
+  FlatAst ast;           // only kept if compiled with PFX_INCREMENTAL
+  bool incremental;
+
+  pfx_program() : incremental(false) { }
+};
+
+struct pfx_env {
+  const pfx_program *prog;
+  Environment env;
+  Vm vm;
+  std::unique_ptr<IncrementalEvaluator> incr;   // created by the first update
+
+  pfx_env(const pfx_program *prog_)
+    : prog(prog_)
+    , env(&prog_->symtab)
+    , vm(&env) {
+    env.resolve_slots();
+  }
+};
+
+namespace {
+
+void set_error(pfx_error *err, int code, const char *message) {
+  if (err != nullptr) {
+    err->code = code;
+    err->line = err->col = 0;
+    strncpy(err->message, message, sizeof(err->message) - 1);
+    err->message[sizeof(err->message) - 1] = '\0';
+  }
+}
+
+// Convert an exception to an error code, filling in the error
+// description if requested
+int report(const pfx_program *prog, const BaseException &ex, int code, pfx_error *err) {
+  set_error(err, code, ex.what());
+  if (err != nullptr && ex.has_location() && !prog->line_starts.empty()) {
+    unsigned long offset = ex.get_loc().get_offset();
+    auto i = std::upper_bound(prog->line_starts.begin(), prog->line_starts.end(), offset);
+    err->line = int(i - prog->line_starts.begin());
+    err->col = int(offset - *(i - 1)) + 1;
+  }
+  return code;
+}
+
+// Run an evaluation function, converting its result or the error
+// it raises to the result of an API function
+template<typename Fn>
+int evaluate(const pfx_program *prog, Fn fn, long *result, pfx_error *err) {
+  try {
+    long value = fn();
+    if (result != nullptr) {
+      *result = value;
+    }
+    return PFX_OK;
+  } catch (SemanticError &ex) {
+    return report(prog, ex, PFX_ERR_UNDEFINED, err);
+  } catch (EvaluationError &ex) {
+    return report(prog, ex, PFX_ERR_DIV_ZERO, err);
+  } catch (BaseException &ex) {
+    return report(prog, ex, PFX_ERR_INTERNAL, err);
+  } catch (std::bad_alloc &) {
+    set_error(err, PFX_ERR_NOMEM, "Out of memory");
+    return PFX_ERR_NOMEM;
+  } catch (...) {
+    set_error(err, PFX_ERR_INTERNAL, "Internal error");
+    return PFX_ERR_INTERNAL;
+  }
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// Library API functions
+////////////////////////////////////////////////////////////////////////
+
+int pfx_compile(const char *text, size_t len, unsigned flags,
+                pfx_program **prog, pfx_error *err) {
+  if (text == nullptr || prog == nullptr) {
+    set_error(err, PFX_ERR_INVALID, "Invalid argument");
+    return PFX_ERR_INVALID;
+  }
+  *prog = nullptr;
+
+  pfx_program *result = new (std::nothrow) pfx_program();
+  if (result == nullptr) {
+    set_error(err, PFX_ERR_NOMEM, "Out of memory");
+    return PFX_ERR_NOMEM;
+  }
+
+  int code = PFX_OK;
+  try {
+    result->line_starts.push_back(0);
+    for (size_t i = 0; i < len; i++) {
+      if (text[i] == '\n') {
+        result->line_starts.push_back(i + 1);
+      }
+    }
+
+    NodeArena arena;
+    Lexer *lexer = new Lexer(new MemoryInputSource(text, len), &result->symtab);
+    Parser parser(lexer, &arena);
+    FlatAst ast;
+    ast.add_unit(parser.parse());
+    arena.clear();
+
+    FlatAst folded;
+    FlatAst *prog_ast = &ast;
+    if (flags & PFX_FOLD) {
+      ConstantFolder folder;
+      folder.fold(ast, folded);
+      prog_ast = &folded;
+    }
+    result->code.compile(*prog_ast);
+    if (flags & PFX_INCREMENTAL) {
+      // the incremental evaluator uses the AST interpreter
+      for (unsigned i = 0; i < prog_ast->get_num_statements(); i++) {
+        result->ast.copy_statement(*prog_ast, i);
+      }
+      result->incremental = true;
+    }
+  } catch (SyntaxError &ex) {
+    code = report(result, ex, PFX_ERR_SYNTAX, err);
+  } catch (BaseException &ex) {
+    code = report(result, ex, PFX_ERR_INTERNAL, err);
+  } catch (std::bad_alloc &) {
+    set_error(err, PFX_ERR_NOMEM, "Out of memory");
+    code = PFX_ERR_NOMEM;
+  } catch (...) {
+    set_error(err, PFX_ERR_INTERNAL, "Internal error");
+    code = PFX_ERR_INTERNAL;
+  }
+
+  if (code != PFX_OK) {
+    delete result;
+    return code;
+  }
+  *prog = result;
+  return PFX_OK;
+}
+
+void pfx_program_free(pfx_program *prog) {
+  delete prog;
+}
+
+unsigned pfx_num_vars(const pfx_program *prog) {
+  return prog != nullptr ? prog->symtab.get_num_symbols() : 0;
+}
+
+const char *pfx_var_name(const pfx_program *prog, unsigned index) {
+  if (prog == nullptr || index >= prog->symtab.get_num_symbols()) {
+    return nullptr;
+  }
+  return prog->symtab.get_name(index).c_str();
+}
+
+int pfx_var_index(const pfx_program *prog, const char *name) {
+  if (prog == nullptr || name == nullptr) {
+    return -1;
+  }
+  try {
+    return prog->symtab.lookup(name);
+  } catch (...) {
+    return -1;
+  }
+}
+
+pfx_env *pfx_env_create(const pfx_program *prog) {
+  if (prog == nullptr) {
+    return nullptr;
+  }
+  try {
+    return new pfx_env(prog);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void pfx_env_free(pfx_env *env) {
+  delete env;
+}
+
+void pfx_env_reset(pfx_env *env) {
+  if (env == nullptr) {
+    return;
+  }
+  env->incr.reset();
+  memset(env->env.get_defined(), 0, env->env.get_num_slots());
+}
+
+int pfx_set(pfx_env *env, const char *name, long value) {
+  if (env == nullptr || name == nullptr) {
+    return PFX_ERR_INVALID;
+  }
+  int index = pfx_var_index(env->prog, name);
+  if (index < 0) {
+    return PFX_ERR_NO_VAR;
+  }
+  return pfx_set_index(env, unsigned(index), value);
+}
+
+int pfx_set_index(pfx_env *env, unsigned index, long value) {
+  if (env == nullptr) {
+    return PFX_ERR_INVALID;
+  }
+  if (index >= env->env.get_num_slots()) {
+    return PFX_ERR_NO_VAR;
+  }
+  env->incr.reset();
+  env->env.get_values()[index] = value;
+  env->env.get_defined()[index] = 1;
+  return PFX_OK;
+}
+
+int pfx_get(const pfx_env *env, const char *name, long *value) {
+  if (env == nullptr || name == nullptr || value == nullptr) {
+    return PFX_ERR_INVALID;
+  }
+  int index = pfx_var_index(env->prog, name);
+  if (index < 0) {
+    return PFX_ERR_NO_VAR;
+  }
+  return pfx_get_index(env, unsigned(index), value);
+}
+
+int pfx_get_index(const pfx_env *env, unsigned index, long *value) {
+  if (env == nullptr || value == nullptr) {
+    return PFX_ERR_INVALID;
+  }
+  if (index >= env->env.get_num_slots()) {
+    return PFX_ERR_NO_VAR;
+  }
+  if (!env->env.get_defined()[index]) {
+    return PFX_ERR_UNDEFINED;
+  }
+  *value = env->env.get_values()[index];
+  return PFX_OK;
+}
+
+int pfx_eval(const pfx_program *prog, pfx_env *env, long *result, pfx_error *err) {
+  if (prog == nullptr || env == nullptr) {
+    set_error(err, PFX_ERR_INVALID, "Invalid argument");
+    return PFX_ERR_INVALID;
+  }
+  if (env->prog != prog) {
+    set_error(err, PFX_ERR_INVALID, "Environment was created for a different program");
+    return PFX_ERR_INVALID;
+  }
+
+  env->incr.reset();
+  return evaluate(prog, [env, prog]() { return env->vm.run(prog->code); }, result, err);
+}
+
+int pfx_update(const pfx_program *prog, pfx_env *env, const char *name, long value,
+               long *result, pfx_error *err) {
+  if (prog == nullptr || env == nullptr || name == nullptr) {
+    set_error(err, PFX_ERR_INVALID, "Invalid argument");
+    return PFX_ERR_INVALID;
+  }
+  int index = pfx_var_index(prog, name);
+  if (index < 0) {
+    set_error(err, PFX_ERR_NO_VAR, "No such variable");
+    return PFX_ERR_NO_VAR;
+  }
+  return pfx_update_index(prog, env, unsigned(index), value, result, err);
+}
+
+int pfx_update_index(const pfx_program *prog, pfx_env *env, unsigned index, long value,
+                     long *result, pfx_error *err) {
+  if (prog == nullptr || env == nullptr) {
+    set_error(err, PFX_ERR_INVALID, "Invalid argument");
+    return PFX_ERR_INVALID;
+  }
+  if (env->prog != prog || !prog->incremental) {
+    set_error(err, PFX_ERR_INVALID, env->prog != prog
+              ? "Environment was created for a different program"
+              : "Program wasn't compiled with PFX_INCREMENTAL");
+    return PFX_ERR_INVALID;
+  }
+  if (index >= env->env.get_num_slots()) {
+    set_error(err, PFX_ERR_NO_VAR, "No such variable");
+    return PFX_ERR_NO_VAR;
+  }
+
+  return evaluate(prog, [env, prog, index, value]() {
+    if (!env->incr) {
+      env->incr.reset(new IncrementalEvaluator(&prog->ast, &env->env));
+    }
+    return env->incr->set_var(index, value);
+  }, result, err);
+}
+
+const char *pfx_strerror(int code) {
+  switch (code) {
+  case PFX_OK:            return "Success";
+  case PFX_ERR_SYNTAX:    return "Syntax error";
+  case PFX_ERR_UNDEFINED: return "Undefined variable";
+  case PFX_ERR_DIV_ZERO:  return "Division by zero";
+  case PFX_ERR_NO_VAR:    return "No such variable";
+  case PFX_ERR_INVALID:   return "Invalid argument";
+  case PFX_ERR_NOMEM:     return "Out of memory";
+  default:                return "Internal error";
+  }
+}
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include "live.h"
+
+////////////////////////////////////////////////////////////////////////
+// DeadStatementEliminator implementation
+////////////////////////////////////////////////////////////////////////
+
+DeadStatementEliminator::DeadStatementEliminator()
+  : m_check_errors(false)
+  , m_num_stmts(0)
+  , m_num_live(0) {
+}
+
+DeadStatementEliminator::~DeadStatementEliminator() {
+}
+
+void DeadStatementEliminator::add_output(unsigned slot) {
+  m_outputs.push_back(slot);
+}
+
+void DeadStatementEliminator::eliminate(const FlatAst &in, FlatAst &out) {
+  unsigned num_stmts = in.get_num_statements();
+  if (num_stmts == 0) {
+    return;
+  }
+
+  // every slot referred to is less than num_slots
+  unsigned num_slots = 0;
+  for (auto i = m_outputs.begin(); i != m_outputs.end(); ++i) {
+    num_slots = std::max(num_slots, *i + 1);
+  }
+  for (unsigned i = 0; i < in.get_num_nodes(); i++) {
+    if (in.get_op(i) == AST_VAR || in.get_op(i) == AST_ASSIGN) {
+      num_slots = std::max(num_slots, unsigned(in.get_payload(i)) + 1);
+    }
+  }
+
+  find_uses_and_defs(in, num_slots);
+
+  // Scan the statements backwards: a statement is live if the value of
+  // a variable it assigns is needed afterwards (or it is the last
+  // statement, whose value is the result).  A live statement's
+  // assignments satisfy the need for the variables it assigns, and it
+  // needs every variable it reads.  (Treating every read as happening
+  // before every assignment in the same statement is conservative.)
+  std::vector<unsigned char> needed(num_slots, 0), live(num_stmts, 0);
+  for (auto i = m_outputs.begin(); i != m_outputs.end(); ++i) {
+    needed[*i] = 1;
+  }
+
+  for (unsigned s = num_stmts; s > 0; s--) {
+    unsigned stmt = s - 1;
+    bool is_live = (stmt == num_stmts - 1) || (m_check_errors && m_may_fail[stmt]);
+    for (unsigned j = m_defs_start[stmt]; !is_live && j < m_defs_start[stmt + 1]; j++) {
+      is_live = needed[m_defs[j]];
+    }
+    if (!is_live) {
+      continue;
+    }
+
+    live[stmt] = 1;
+    for (unsigned j = m_defs_start[stmt]; j < m_defs_start[stmt + 1]; j++) {
+      needed[m_defs[j]] = 0;
+    }
+    for (unsigned j = m_uses_start[stmt]; j < m_uses_start[stmt + 1]; j++) {
+      needed[m_uses[j]] = 1;
+    }
+  }
+
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    if (live[stmt]) {
+      out.copy_statement(in, stmt);
+      m_num_live++;
+    }
+  }
+  m_num_stmts += num_stmts;
+}
+
+void DeadStatementEliminator::print_stats(FILE *out) const {
+  fprintf(out, "live: %lu of %lu statements executed\n", m_num_live, m_num_stmts);
+}
+
+// Record the variables read and assigned by each statement, and
+// whether each statement might raise an error.  A variable which has
+// been assigned by an earlier statement is definitely defined, since
+// if the earlier statement failed, execution would have stopped.
+void DeadStatementEliminator::find_uses_and_defs(const FlatAst &in, unsigned num_slots) {
+  unsigned num_stmts = in.get_num_statements();
+  std::vector<unsigned char> assigned(num_slots, 0);
+
+  m_uses.clear();
+  m_uses_start.clear();
+  m_defs.clear();
+  m_defs_start.clear();
+  m_may_fail.assign(num_stmts, 0);
+
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    m_uses_start.push_back(unsigned(m_uses.size()));
+    m_defs_start.push_back(unsigned(m_defs.size()));
+
+    unsigned end = in.get_statement_end(stmt);
+    for (unsigned i = in.get_statement(stmt); i < end; i++) {
+      unsigned slot = unsigned(in.get_payload(i));
+      switch (in.get_op(i)) {
+      case AST_VAR:
+        m_uses.push_back(slot);
+        if (!assigned[slot]) {
+          m_may_fail[stmt] = 1;
+        }
+        break;
+      case AST_ASSIGN:
+        m_defs.push_back(slot);
+        break;
+      case AST_DIV: {
+        unsigned right = in.get_right(i);
+        if (in.get_op(right) != AST_LITERAL || in.get_payload(right) == 0) {
+          m_may_fail[stmt] = 1;
+        }
+        break;
+      }
+      default:
+        break;
+      }
+    }
+
+    for (unsigned j = m_defs_start[stmt]; j < m_defs.size(); j++) {
+      assigned[m_defs[j]] = 1;
+    }
+  }
+
+  m_uses_start.push_back(unsigned(m_uses.size()));
+  m_defs_start.push_back(unsigned(m_defs.size()));
+}
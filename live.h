@@ -0,0 +1,57 @@
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <cstdio>
+#include <vector>
+#include "ast.h"
+
+// Dead statement elimination.  Only the value of the last statement
+// (and the final values of any variables explicitly requested as
+// outputs) are observable, so a statement whose assignments are never
+// read by a statement contributing to them doesn't need to be
+// executed.  A backwards liveness analysis over the statements of the
+// unit finds the statements which are needed.
+//
+// Skipping a statement also skips any error it would have raised.  If
+// error checking is enabled, statements which might raise an error
+// (by referring to a variable which might not be defined, or by
+// dividing by something other than a nonzero constant) are always
+// kept, so that errors are reported exactly as they would be if every
+// statement were executed.
+class DeadStatementEliminator {
+private:
+  std::vector<unsigned> m_outputs;      // slots of output variables
+  bool m_check_errors;
+
+  // slots read and assigned by each statement (statement i's are
+  // elements m_*_start[i] .. m_*_start[i+1]-1)
+  std::vector<unsigned> m_uses, m_uses_start;
+  std::vector<unsigned> m_defs, m_defs_start;
+  std::vector<unsigned char> m_may_fail;
+
+  unsigned long m_num_stmts, m_num_live;
+
+  // no value semantics
+  DeadStatementEliminator(const DeadStatementEliminator &);
+  DeadStatementEliminator &operator=(const DeadStatementEliminator &);
+
+public:
+  DeadStatementEliminator();
+  ~DeadStatementEliminator();
+
+  // The final value of the variable with given slot is needed
+  void add_output(unsigned slot);
+
+  // Keep statements which might raise an error
+  void set_check_errors(bool check_errors) { m_check_errors = check_errors; }
+
+  // Copy the statements of in which are needed to out
+  void eliminate(const FlatAst &in, FlatAst &out);
+
+  void print_stats(FILE *out) const;
+
+private:
+  void find_uses_and_defs(const FlatAst &in, unsigned num_slots);
+};
+
+#endif // LIVE_H
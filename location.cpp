@@ -18,34 +18,26 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include "srcmgr.h"
 #include "location.h"
 
-Location::Location()
-  : m_srcfile("<unknown>")
-  , m_line(-1)
-  , m_col(-1) {
-}
-
-Location::Location(const std::string &srcfile, int line, int col)
-  : m_srcfile(srcfile)
-  , m_line(line)
-  , m_col(col) {
-}
-
-Location::Location(const Location &other)
-  : m_srcfile(other.m_srcfile)
-  , m_line(other.m_line)
-  , m_col(other.m_col) {
+std::string Location::get_srcfile() const {
+  if (!is_valid() || get_src() == UNREGISTERED_SRC) {
+    return "<unknown>";
+  }
+  return SourceManager::get_instance().get_filename(get_src());
 }
 
-Location::~Location() {
+int Location::get_line() const {
+  if (!is_valid() || get_src() == UNREGISTERED_SRC) {
+    return -1;
+  }
+  return SourceManager::get_instance().get_line(get_src(), get_offset());
 }
 
-Location &Location::operator=(const Location &rhs) {
-  if (this != &rhs) {
-    m_srcfile = rhs.m_srcfile;
-    m_line = rhs.m_line;
-    m_col = rhs.m_col;
+int Location::get_col() const {
+  if (!is_valid() || get_src() == UNREGISTERED_SRC) {
+    return -1;
   }
-  return *this;
+  return SourceManager::get_instance().get_col(get_src(), get_offset());
 }
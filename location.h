@@ -22,29 +22,41 @@
 #define LOCATION_H
 
 #include <string>
+#include <cstdint>
 
+// A Location is a compact handle identifying a position in a source
+// of input: the source id (assigned by the SourceManager) is packed
+// into the upper 16 bits, and the byte offset within the source into
+// the lower 48 bits.  Filenames and line/column numbers are looked up
+// through the SourceManager when they are needed.
 class Location {
 private:
-  std::string m_srcfile;
-  int m_line, m_col;
+  uint64_t m_handle;  // 0 if the location is not valid
 
-public:
-  Location();
-  Location(const std::string &srcfile, int line, int col);
-  Location(const Location &other);
-  ~Location();
+  enum {
+    OFFSET_BITS = 48,
+  };
 
-  Location &operator=(const Location &rhs);
+public:
+  // Source id of input which isn't registered with the SourceManager
+  // (see Lexer).  Locations in such input only identify a byte offset:
+  // the filename and line/column numbers aren't known.
+  enum {
+    UNREGISTERED_SRC = 0xFFFE,
+  };
 
-  bool is_valid() const { return m_line > 0; }
+  Location() : m_handle(0) { }
+  Location(unsigned src, unsigned long offset)
+    : m_handle((uint64_t(src + 1) << OFFSET_BITS) | (uint64_t(offset) & ((uint64_t(1) << OFFSET_BITS) - 1))) { }
 
-  std::string get_srcfile() const { return m_srcfile; }
-  int get_line() const { return m_line; }
-  int get_col() const { return m_col; }
+  bool is_valid() const { return m_handle != 0; }
 
-  void advance(int num_cols) { m_col += num_cols; }
+  unsigned get_src() const { return unsigned(m_handle >> OFFSET_BITS) - 1; }
+  unsigned long get_offset() const { return (unsigned long) (m_handle & ((uint64_t(1) << OFFSET_BITS) - 1)); }
 
-  void next_line() { m_line++; m_col = 1; }
+  std::string get_srcfile() const;
+  int get_line() const;
+  int get_col() const;
 };
 
 #endif // LOCATION_H
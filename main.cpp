@@ -1,32 +1,261 @@
 #include <cstdio>
+#include <cstdlib>
 #include <memory>
-#include <unistd.h> // for getopt
+#include <string>
+#include <vector>
+#include <getopt.h> // for getopt_long
 #include "lexer.h"
 #include "parser.h"
 #include "interp.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "jit.h"
+#include "cemit.h"
+#include "fold.h"
+#include "cse.h"
+#include "live.h"
+#include "rebalance.h"
+#include "parallel.h"
+#include "batch.h"
+#include "server.h"
+#include "cache.h"
 #include "exceptions.h"
 
 enum {
   INTERPRET,
+  INTERPRET_STREAMING,
   PRINT_TOKENS,
   PRINT_PARSE_TREE,
+  PRINT_AST,
+  PRINT_BYTECODE,
+  EMIT_C,
+  EVAL_COLUMNS,
 };
 
+// Engines for executing code
+enum {
+  ENGINE_INTERP,   // AST interpreter
+  ENGINE_VM,       // bytecode VM
+  ENGINE_JIT,      // native code (where supported)
+  ENGINE_PARALLEL, // AST interpreter, independent statements in parallel
+};
+
+// Print the final values of the requested output variables
+void print_outputs(const std::vector<std::string> &outputs, const Environment &env) {
+  for (auto i = outputs.begin(); i != outputs.end(); ++i) {
+    long value;
+    if (env.get_var(*i, value)) {
+      printf("%s = %ld\n", i->c_str(), value);
+    } else {
+      printf("%s is undefined\n", i->c_str());
+    }
+  }
+}
+
+void print_error(const BaseException &ex) {
+  if (ex.has_location()) {
+    const Location &loc = ex.get_loc();
+    fprintf(stderr, "%s:%d: Error: %s\n", loc.get_srcfile().c_str(), loc.get_line(), ex.what());
+  } else {
+    fprintf(stderr, "Error: %s\n", ex.what());
+  }
+}
+
+// Evaluate a program once for each row of a CSV/TSV file, whose columns
+// supply the values of variables.  Writes the result and the values of
+// the output variables for each row, in the same format.  Errors are
+// reported for the rows which fail, without stopping.  Returns the
+// exit code (1 if any rows failed).
+int eval_columns(const FlatAst &prog, SymbolTable &symtab, const char *input,
+                 const std::vector<std::string> &outputs, bool stats) {
+  CsvReader reader(input);
+  unsigned num_columns = reader.get_num_columns();
+  std::vector<unsigned> column_slots;
+  for (unsigned i = 0; i < num_columns; i++) {
+    column_slots.push_back(symtab.intern(reader.get_column_name(i)));
+  }
+  std::vector<unsigned> output_slots;
+  for (auto i = outputs.begin(); i != outputs.end(); ++i) {
+    output_slots.push_back(symtab.intern(*i));
+  }
+
+  Bytecode code;
+  code.compile(prog);
+  Environment env(&symtab);
+  BatchEvaluator evaluator(&code, &env);
+
+  unsigned block = evaluator.get_block_size();
+  unsigned num_slots = env.get_num_slots();
+  std::vector<long> values(size_t(num_slots) * block);
+  std::vector<unsigned char> defined(size_t(num_slots) * block);
+  std::vector<long> fields(num_columns);
+  std::vector<unsigned char> present(num_columns);
+  std::vector<std::string> input_errors(block);
+  std::vector<unsigned long> lines(block);
+  unsigned long num_rows = 0, num_errors = 0;
+  char delim = reader.get_delim();
+
+  printf("result");
+  for (auto i = outputs.begin(); i != outputs.end(); ++i) {
+    printf("%c%s", delim, i->c_str());
+  }
+  printf("\n");
+
+  for (;;) {
+    // read a block of rows
+    std::fill(defined.begin(), defined.end(), 0);
+    unsigned n = 0;
+    while (n < block && reader.read_row(fields.data(), present.data(), input_errors[n])) {
+      for (unsigned i = 0; i < num_columns; i++) {
+        size_t index = size_t(column_slots[i]) * block + n;
+        values[index] = fields[i];
+        defined[index] = present[i];
+      }
+      lines[n] = reader.get_line();
+      n++;
+    }
+    if (n == 0) {
+      break;
+    }
+
+    evaluator.eval(n, values.data(), defined.data());
+
+    for (unsigned row = 0; row < n; row++) {
+      bool ok = false;
+      if (!input_errors[row].empty()) {
+        fprintf(stderr, "%s:%lu: Error: %s\n", input, lines[row], input_errors[row].c_str());
+      } else if (evaluator.is_error(row)) {
+        try {
+          evaluator.raise_error(row);
+        } catch (BaseException &ex) {
+          fprintf(stderr, "%s:%lu: ", input, lines[row]);
+          print_error(ex);
+        }
+      } else {
+        ok = true;
+      }
+
+      // a failed row has empty fields
+      if (ok) {
+        printf("%ld", evaluator.get_result(row));
+      } else {
+        num_errors++;
+      }
+      for (auto i = output_slots.begin(); i != output_slots.end(); ++i) {
+        size_t index = size_t(*i) * block + row;
+        if (ok && defined[index]) {
+          printf("%c%ld", delim, values[index]);
+        } else {
+          printf("%c", delim);
+        }
+      }
+      printf("\n");
+    }
+    num_rows += n;
+  }
+
+  if (stats) {
+    fprintf(stderr, "batch: %lu rows, %lu errors, %u rows per block, %s arithmetic\n",
+            num_rows, num_errors, block, BatchEvaluator::get_impl_name());
+  }
+
+  return num_errors > 0 ? 1 : 0;
+}
+
 int execute(int argc, char **argv) {
-  int mode = INTERPRET, opt;
-  while ((opt = getopt(argc, argv, "lp")) != -1) {
+  int mode = INTERPRET, engine = ENGINE_INTERP, opt;
+  unsigned num_threads = 0;
+  const char *columns = nullptr, *socket_path = nullptr, *cache_dir = nullptr, *c_prefix = nullptr;
+  bool fold = false, cse = false, live = false, balance = false, check_errors = false, stats = false;
+  std::vector<std::string> outputs;
+  static const struct option long_opts[] = {
+    { "serve", required_argument, nullptr, 'V' },
+    { nullptr, 0, nullptr, 0 },
+  };
+  while ((opt = getopt_long(argc, argv, "abcdi:jk:lo:pst:CELOP:RS", long_opts, nullptr)) != -1) {
     switch (opt) {
+    case 'a':
+      mode = PRINT_AST;
+      break;
+    case 'b':
+      engine = ENGINE_VM;
+      break;
+    case 'c':
+      mode = EMIT_C;
+      break;
+    case 'd':
+      mode = PRINT_BYTECODE;
+      break;
+    case 'i':
+      mode = EVAL_COLUMNS;
+      columns = optarg;
+      break;
+    case 'j':
+      engine = ENGINE_JIT;
+      break;
+    case 'k':
+      cache_dir = optarg;
+      break;
     case 'l':
       mode = PRINT_TOKENS;
       break;
+    case 'o':
+      outputs.push_back(optarg);
+      break;
     case 'p':
       mode = PRINT_PARSE_TREE;
       break;
+    case 's':
+      mode = INTERPRET_STREAMING;
+      break;
+    case 't':
+      // 0 threads means one per CPU
+      engine = ENGINE_PARALLEL;
+      num_threads = unsigned(atoi(optarg));
+      break;
+    case 'C':
+      cse = true;
+      break;
+    case 'E':
+      check_errors = true;
+      break;
+    case 'L':
+      live = true;
+      break;
+    case 'O':
+      fold = true;
+      break;
+    case 'P':
+      // prefix of the names defined by the C code emitted by -c
+      c_prefix = optarg;
+      break;
+    case 'R':
+      balance = true;
+      break;
+    case 'S':
+      stats = true;
+      break;
+    case 'V':
+      socket_path = optarg;
+      break;
     default:
       RuntimeError::raise("Unknown option: %c", opt);
     }
   }
 
+  if (socket_path != nullptr) {
+    // serve requests on a socket rather than reading a program
+    // (-t sets the number of worker threads)
+    Server server(socket_path, num_threads);
+    server.run();
+    return 0;
+  }
+
+  // the interpreter is used if native code can't be generated
+  if (engine == ENGINE_JIT && !Jit::is_supported()) {
+    engine = ENGINE_INTERP;
+  }
+
   FILE *in;
   const char *filename;
 
@@ -42,32 +271,194 @@ int execute(int argc, char **argv) {
     in = stdin;
   }
 
-  std::unique_ptr<Lexer> lexer(new Lexer(in, filename));
+  SymbolTable symtab;
+  NodeArena arena;
+  DeadStatementEliminator dse;
+  dse.set_check_errors(check_errors);
+  for (auto i = outputs.begin(); i != outputs.end(); ++i) {
+    dse.add_output(symtab.intern(*i));
+  }
+
+  // A program which is parsed all at once may be loaded from the
+  // cache, in which case it isn't lexed or parsed at all
+  FlatAst ast;
+  std::unique_ptr<ProgramCache> cache;
+  bool cached = false;
+  if (cache_dir != nullptr && mode != PRINT_TOKENS && mode != PRINT_PARSE_TREE &&
+      mode != INTERPRET_STREAMING) {
+    cache.reset(new ProgramCache(cache_dir));
+    cached = cache->load(in, filename, symtab, ast);
+  }
+  std::unique_ptr<Lexer> lexer(cached ? nullptr : new Lexer(in, filename, &symtab));
 
   if (mode == PRINT_TOKENS) {
     bool done = false;
     while (!done) {
-      Node *tok = lexer->peek();
-      if (tok == nullptr) {
+      Token tok = lexer->peek();
+      if (tok.kind == TOK_EOF) {
         done = true;
       } else {
-        int kind = tok->get_tag();
-        std::string lexeme = tok->get_str();
-        printf("%d:%s\n", kind, lexeme.c_str());
-        delete tok;
+        printf("%d:%.*s\n", tok.kind, int(tok.len), tok.lexeme);
+        lexer->next();
+      }
+    }
+  } else if (mode == INTERPRET_STREAMING) {
+    // Execute each statement as soon as it is parsed, then free it
+    // (by clearing the arena), so that memory use doesn't depend on
+    // the size of the input.  Whether a statement is needed depends
+    // on the statements after it, so dead statements aren't skipped.
+    std::unique_ptr<Parser> parser(new Parser(lexer.release(), &arena));
+    Environment env(&symtab);
+    FlatAst folded, balanced, shared;
+    FlatAst *prog = cse ? &shared : balance ? &balanced : fold ? &folded : &ast;
+    ConstantFolder folder;
+    ChainRebalancer rebalancer;
+    CommonSubexprEliminator eliminator(&symtab);
+    std::unique_ptr<Interpreter> interp(new Interpreter(prog, &env));
+    Bytecode code;
+    Vm vm(&env);
+    Jit jit(&env);
+    long result;
+    do {
+      ast.clear();
+      unsigned stmt = ast.add_statement(parser->parse_statement());
+      arena.clear();
+      if (fold) {
+        folded.clear();
+        stmt = folder.fold_statement(ast, stmt, folded);
+      }
+      if (balance) {
+        balanced.clear();
+        stmt = rebalancer.rebalance_statement(fold ? folded : ast, stmt, balanced);
+      }
+      if (cse) {
+        // subexpressions are only shared within each statement
+        shared.clear();
+        eliminator.eliminate(balance ? balanced : fold ? folded : ast, shared);
+        stmt = 0;
+      }
+      if (engine == ENGINE_VM) {
+        code.compile_statement(*prog, stmt);
+        result = vm.run(code);
+      } else if (engine == ENGINE_JIT) {
+        code.compile_statement(*prog, stmt);
+        jit.compile(code);
+        result = jit.run();
+      } else {
+        result = interp->exec_statement(stmt);
       }
+      parser->discard_line_info();
+    } while (!parser->at_end());
+    printf("Result: %ld\n", result);
+    print_outputs(outputs, env);
+
+    if (stats && fold) {
+      folder.print_stats(stderr);
     }
+    if (stats && balance) {
+      rebalancer.print_stats(stderr);
+    }
+    if (stats && cse) {
+      eliminator.print_stats(stderr);
+    }
+  } else if (mode == PRINT_PARSE_TREE) {
+    std::unique_ptr<Parser> parser(new Parser(lexer.release(), &arena));
+    ParserTreePrint ptp(&symtab);
+    ptp.print(parser->parse());
   } else {
-    std::unique_ptr<Parser> parser(new Parser(lexer.release()));
-    std::unique_ptr<Node> root(parser->parse());
+    if (!cached) {
+      // lower the parse tree to a flat AST, after which the parse
+      // tree is no longer needed
+      std::unique_ptr<Parser> parser(new Parser(lexer.release(), &arena));
+      ast.add_unit(parser->parse());
+      arena.clear();
+      if (cache) {
+        cache->store(ast, symtab);
+      }
+    }
+    if (stats && cache) {
+      cache->print_stats(stderr);
+    }
+
+    // optimization passes
+    FlatAst folded, needed, balanced, shared;
+    FlatAst *prog = &ast;
+    ConstantFolder folder;
+    ChainRebalancer rebalancer;
+    CommonSubexprEliminator eliminator(&symtab);
+    if (fold) {
+      folder.fold(*prog, folded);
+      prog = &folded;
+    }
+    if (live) {
+      // before CSE, so that temporaries don't keep dead statements alive
+      dse.eliminate(*prog, needed);
+      prog = &needed;
+    }
+    if (balance) {
+      rebalancer.rebalance(*prog, balanced);
+      prog = &balanced;
+    }
+    if (cse) {
+      eliminator.eliminate(*prog, shared);
+      prog = &shared;
+    }
+    if (stats && fold) {
+      folder.print_stats(stderr);
+    }
+    if (stats && live) {
+      dse.print_stats(stderr);
+    }
+    if (stats && balance) {
+      rebalancer.print_stats(stderr);
+    }
+    if (stats && cse) {
+      eliminator.print_stats(stderr);
+    }
 
-    if (mode == PRINT_PARSE_TREE) {
-      ParserTreePrint ptp;
-      ptp.print(root.get());
+    if (mode == PRINT_AST) {
+      FlatAstPrint fap(&symtab);
+      fap.print(*prog);
+    } else if (mode == PRINT_BYTECODE) {
+      Bytecode code;
+      code.compile(*prog);
+      code.disassemble(&symtab);
+    } else if (mode == EVAL_COLUMNS) {
+      return eval_columns(*prog, symtab, columns, outputs, stats);
+    } else if (mode == EMIT_C) {
+      Bytecode code;
+      code.compile(*prog);
+      CEmitter emitter(&symtab);
+      if (c_prefix != nullptr) {
+        emitter.set_prefix(c_prefix);
+      }
+      emitter.emit(code);
     } else {
-      std::unique_ptr<Interpreter> interp(new Interpreter(root.get()));
-      long result = interp->exec();
+      Environment env(&symtab);
+      long result;
+      if (engine == ENGINE_VM) {
+        Bytecode code;
+        code.compile(*prog);
+        Vm vm(&env);
+        result = vm.run(code);
+      } else if (engine == ENGINE_JIT) {
+        Bytecode code;
+        code.compile(*prog);
+        Jit jit(&env);
+        jit.compile(code);
+        result = jit.run();
+      } else if (engine == ENGINE_PARALLEL) {
+        ParallelExecutor executor(prog, &env, num_threads);
+        result = executor.exec();
+        if (stats) {
+          executor.print_stats(stderr);
+        }
+      } else {
+        std::unique_ptr<Interpreter> interp(new Interpreter(prog, &env));
+        result = interp->exec();
+      }
       printf("Result: %ld\n", result);
+      print_outputs(outputs, env);
     }
   }
 
@@ -78,12 +469,7 @@ int main(int argc, char **argv) {
   try {
     return execute(argc, argv);
   } catch (BaseException &ex) {
-    if (ex.has_location()) {
-      const Location &loc = ex.get_loc();
-      fprintf(stderr, "%s:%d: Error: %s\n", loc.get_srcfile().c_str(), loc.get_line(), ex.what());
-    } else {
-      fprintf(stderr, "Error: %s\n", ex.what());
-    }
+    print_error(ex);
     return 1;
   }
 }
@@ -18,57 +18,58 @@
 // ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <cstring>
+#include <stdexcept>
 #include "node.h"
 
-// Private constructor, used only by other constructors
-Node::Node(int tag, const std::string &str, const std::vector<Node *> &kids)
+Node::Node(NodeArena *arena, int tag)
   : m_tag(tag)
-  , m_kids(kids)
-  , m_str(str)
-  , m_loc_was_set_explicitly(false) {
+  , m_num_kids(0)
+  , m_kid_capacity(NUM_INLINE_KIDS)
+  , m_kids(m_inline_kids)
+  , m_str("")
+  , m_str_len(0)
+  , m_loc_was_set_explicitly(false)
+  , m_arena(arena) {
 }
 
-// Private constructor, used only by other constructors
-Node::Node(int tag, const std::string &str, const std::initializer_list<Node *> kids)
-  : m_tag(tag)
-  , m_kids(kids)
-  , m_str(str)
-  , m_loc_was_set_explicitly(false) {
+Node::Node(NodeArena *arena, int tag, std::initializer_list<Node *> kids)
+  : Node(arena, tag) {
+  init_kids(kids.begin(), unsigned(kids.size()));
 }
 
-Node::Node(int tag)
-  : Node(tag, "", {}) {
+Node::Node(NodeArena *arena, int tag, const std::vector<Node *> &kids)
+  : Node(arena, tag) {
+  init_kids(kids.data(), unsigned(kids.size()));
 }
 
-Node::Node(int tag, std::initializer_list<Node *> kids)
-  : Node(tag, "", kids) {
-  // parent node's location defaults to first kid's location
-  if (!m_kids.empty()) {
-    m_loc = m_kids[0]->get_loc();
-  }
+Node::Node(NodeArena *arena, int tag, const std::string &str)
+  : Node(arena, tag) {
+  set_str(str);
 }
 
-Node::Node(int tag, const std::vector<Node *> &kids)
-  : Node(tag, "", kids) {
-  // parent node's location defaults to first kid's location
-  if (!m_kids.empty()) {
-    m_loc = m_kids[0]->get_loc();
-  }
+Node::~Node() {
+  // Nothing to do: children, strings, and overflow child arrays
+  // are all owned by the arena
 }
 
-Node::Node(int tag, const std::string &str)
-  : Node(tag, str, {}) {
+void Node::set_str(const std::string &str) {
+  m_str = m_arena->copy_str(str.data(), str.size());
+  m_str_len = unsigned(str.size());
 }
 
-Node::~Node() {
-  // delete child nodes
-  for (auto i = m_kids.begin(); i != m_kids.end(); ++i) {
-    delete *i;
+Node *Node::get_kid(unsigned index) const {
+  if (index >= m_num_kids) {
+    throw std::out_of_range("Node::get_kid");
   }
+  return m_kids[index];
 }
 
 void Node::append_kid(Node *kid) {
-  m_kids.push_back(kid);
+  if (m_num_kids == m_kid_capacity) {
+    grow_kids();
+  }
+  m_kids[m_num_kids++] = kid;
   // parent node's location defaults to first kid's location
   if (!m_loc.is_valid()) {
     m_loc = kid->get_loc();
@@ -76,7 +77,12 @@ void Node::append_kid(Node *kid) {
 }
 
 void Node::prepend_kid(Node *kid) {
-  m_kids.insert(m_kids.begin(), kid);
+  if (m_num_kids == m_kid_capacity) {
+    grow_kids();
+  }
+  memmove(m_kids + 1, m_kids, m_num_kids * sizeof(Node *));
+  m_kids[0] = kid;
+  m_num_kids++;
 
   // Here, we update the parent's location unconditionally
   // (since we generally want the parent's location to match that
@@ -86,3 +92,29 @@ void Node::prepend_kid(Node *kid) {
     m_loc = kid->get_loc();
   }
 }
+
+// Used by constructors taking a list of children
+void Node::init_kids(Node *const *kids, unsigned num_kids) {
+  for (unsigned i = 0; i < num_kids; i++) {
+    if (m_num_kids == m_kid_capacity) {
+      grow_kids();
+    }
+    m_kids[m_num_kids++] = kids[i];
+  }
+  // parent node's location defaults to first kid's location
+  if (num_kids > 0) {
+    m_loc = kids[0]->get_loc();
+  }
+}
+
+// Move the children to a larger array allocated from the arena.
+// (The old array isn't reclaimed until the arena is cleared, but
+// since the capacity doubles, the waste is bounded by the size
+// of the final array.)
+void Node::grow_kids() {
+  unsigned capacity = m_kid_capacity * 2;
+  Node **kids = static_cast<Node **>(m_arena->alloc(capacity * sizeof(Node *)));
+  memcpy(kids, m_kids, m_num_kids * sizeof(Node *));
+  m_kids = kids;
+  m_kid_capacity = capacity;
+}
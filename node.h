@@ -25,63 +25,86 @@
 #include <string>
 #include "location.h"
 #include "node_base.h"
+#include "node_arena.h"
 
 // Tree node class, suitable for parse trees and ASTs.
-// Nodes can also be used as tokens returned by a lexer.
-// Note that parent nodes take responsibility for deleting
-// their children, so to delete an entire tree, it is
-// sufficient to delete the root.
+// Nodes are allocated from a NodeArena, which also holds their
+// child arrays and strings.  Individual nodes are never deleted:
+// an entire tree is freed at once by clearing or destroying the
+// arena it was allocated from.
 
 class Node : public NodeBase {
 private:
+  enum { NUM_INLINE_KIDS = 3 };
+
   int m_tag;
-  std::vector<Node *> m_kids;
-  std::string m_str;
+  unsigned m_num_kids, m_kid_capacity;
+  Node **m_kids;                        // points to m_inline_kids or arena memory
+  Node *m_inline_kids[NUM_INLINE_KIDS];
+  const char *m_str;
+  unsigned m_str_len;
   Location m_loc;
   bool m_loc_was_set_explicitly;
+  NodeArena *m_arena;
 
   // no value semantics
   Node(const Node &);
   Node &operator=(const Node &);
 
-  Node(int tag, const std::string &str, const std::vector<Node *> &kids);
-  Node(int tag, const std::string &str, const std::initializer_list<Node *> kids);
+  void init_kids(Node *const *kids, unsigned num_kids);
+  void grow_kids();
 
 public:
-  typedef std::vector<Node *>::const_iterator const_iterator;
+  typedef Node *const *const_iterator;
 
-  Node(int tag);
-  Node(int tag, std::initializer_list<Node *> kids);
-  Node(int tag, const std::vector<Node *> &kids);
-  Node(int tag, const std::string &str);
+  Node(NodeArena *arena, int tag);
+  Node(NodeArena *arena, int tag, std::initializer_list<Node *> kids);
+  Node(NodeArena *arena, int tag, const std::vector<Node *> &kids);
+  Node(NodeArena *arena, int tag, const std::string &str);
 
   virtual ~Node();
 
+  // Nodes must be allocated from an arena, e.g.
+  //   new (arena) Node(arena, tag)
+  static void *operator new(size_t size, NodeArena *arena) { return arena->alloc(size); }
+  static void operator delete(void *, NodeArena *) { }
+  // deleting a node does nothing: its memory belongs to the arena
+  static void operator delete(void *) { }
+
+  NodeArena *get_arena() const { return m_arena; }
+
   int get_tag() const { return m_tag; }
   void set_tag(int tag) { m_tag = tag; }
 
-  std::string get_str() const { return m_str; }
-  void set_str(const std::string &str) { m_str = str; }
+  std::string get_str() const { return std::string(m_str, m_str_len); }
+  void set_str(const std::string &str);
 
   void append_kid(Node *kid);
   void prepend_kid(Node *kid);
-  unsigned get_num_kids() const { return unsigned(m_kids.size()); }
-  Node *get_kid(unsigned index) const { return m_kids.at(index); }
-  Node *get_last_kid() const { return m_kids.back(); }
+  unsigned get_num_kids() const { return m_num_kids; }
+  Node *get_kid(unsigned index) const;
+  Node *get_last_kid() const { return m_kids[m_num_kids - 1]; }
 
-  const_iterator cbegin() const { return m_kids.cbegin(); }
-  const_iterator cend() const { return m_kids.cend(); }
+  const_iterator cbegin() const { return m_kids; }
+  const_iterator cend() const { return m_kids + m_num_kids; }
 
   void set_loc(const Location &loc) { m_loc = loc; m_loc_was_set_explicitly = true; }
   const Location &get_loc() const { return m_loc; }
 
   // do a preorder traversal of the tree, invoking specified
-  // function on each node
+  // function on each node (using an explicit stack, so that the
+  // depth of the tree isn't limited by the size of the call stack)
   template<typename Fn>
   void preorder(Fn fn) {
-    fn(this);
-    for (auto i = m_kids.begin(); i != m_kids.end(); ++i) {
-      (*i)->preorder(fn);
+    std::vector<Node *> stack;
+    stack.push_back(this);
+    while (!stack.empty()) {
+      Node *n = stack.back();
+      stack.pop_back();
+      fn(n);
+      for (unsigned i = n->m_num_kids; i > 0; i--) {
+        stack.push_back(n->m_kids[i - 1]);
+      }
     }
   }
 };
@@ -0,0 +1,78 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "node_arena.h"
+
+////////////////////////////////////////////////////////////////////////
+// NodeArena implementation
+////////////////////////////////////////////////////////////////////////
+
+NodeArena::NodeArena()
+  : m_cur(0)
+  , m_pos(nullptr)
+  , m_end(nullptr) {
+}
+
+NodeArena::~NodeArena() {
+  clear();
+  for (auto i = m_chunks.begin(); i != m_chunks.end(); ++i) {
+    free(i->mem);
+  }
+}
+
+const char *NodeArena::copy_str(const char *s, size_t len) {
+  char *copy = static_cast<char *>(alloc(len + 1));
+  memcpy(copy, s, len);
+  copy[len] = '\0';
+  return copy;
+}
+
+void NodeArena::clear() {
+  for (auto i = m_large.begin(); i != m_large.end(); ++i) {
+    free(*i);
+  }
+  m_large.clear();
+
+  // start over at the first chunk
+  m_cur = 0;
+  if (m_chunks.empty()) {
+    m_pos = m_end = nullptr;
+  } else {
+    m_pos = m_chunks[0].mem;
+    m_end = m_pos + m_chunks[0].size;
+  }
+}
+
+// Handle an allocation which doesn't fit in the current chunk
+void *NodeArena::alloc_slow(size_t size) {
+  if (size >= LARGE_SIZE) {
+    char *mem = static_cast<char *>(malloc(size));
+    if (mem == nullptr) {
+      throw std::bad_alloc();
+    }
+    m_large.push_back(mem);
+    return mem;
+  }
+
+  // move on to the next chunk, allocating it if necessary
+  if (!m_chunks.empty() && m_pos != nullptr) {
+    m_cur++;
+  }
+  if (m_cur >= m_chunks.size()) {
+    Chunk chunk;
+    chunk.mem = static_cast<char *>(malloc(CHUNK_SIZE));
+    if (chunk.mem == nullptr) {
+      throw std::bad_alloc();
+    }
+    chunk.size = CHUNK_SIZE;
+    m_chunks.push_back(chunk);
+    m_cur = unsigned(m_chunks.size() - 1);
+  }
+
+  m_pos = m_chunks[m_cur].mem;
+  m_end = m_pos + m_chunks[m_cur].size;
+
+  void *p = m_pos;
+  m_pos += size;
+  return p;
+}
@@ -0,0 +1,63 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+// A NodeArena is a region of memory from which tree Nodes (and the
+// data they refer to, such as child arrays and strings) are allocated
+// by bumping a pointer.  Individual objects are never freed: instead,
+// everything allocated from the arena is released at once, either by
+// calling clear() or by destroying the arena.  Destructors of objects
+// allocated in the arena are never run, so only trivially-destructible
+// data (or data whose destructor has nothing important to do)
+// should be allocated in an arena.
+class NodeArena {
+private:
+  struct Chunk {
+    char *mem;
+    size_t size;
+  };
+
+  std::vector<Chunk> m_chunks;   // chunks which are reused after clear()
+  std::vector<char *> m_large;   // large allocations, freed by clear()
+  unsigned m_cur;                // index of chunk currently being used
+  char *m_pos, *m_end;           // free space in current chunk
+
+  // no value semantics
+  NodeArena(const NodeArena &);
+  NodeArena &operator=(const NodeArena &);
+
+public:
+  enum {
+    CHUNK_SIZE = 64 * 1024,
+    LARGE_SIZE = CHUNK_SIZE / 4,  // allocations this big get their own memory
+    ALIGN = alignof(std::max_align_t),
+  };
+
+  NodeArena();
+  ~NodeArena();
+
+  // Allocate given number of bytes (suitably aligned for any type)
+  void *alloc(size_t size) {
+    size = (size + ALIGN - 1) & ~size_t(ALIGN - 1);
+    if (size_t(m_end - m_pos) < size) {
+      return alloc_slow(size);
+    }
+    void *p = m_pos;
+    m_pos += size;
+    return p;
+  }
+
+  // Copy a string into the arena (the copy is NUL-terminated)
+  const char *copy_str(const char *s, size_t len);
+
+  // Release everything allocated from the arena.  The memory of
+  // ordinary chunks is kept so that it can be reused.
+  void clear();
+
+private:
+  void *alloc_slow(size_t size);
+};
+
+#endif // NODE_ARENA_H
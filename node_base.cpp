@@ -20,7 +20,9 @@
 
 #include "node_base.h"
 
-NodeBase::NodeBase() {
+NodeBase::NodeBase()
+  : m_ival(0)
+  , m_sym(-1) {
 }
 
 NodeBase::~NodeBase() {
@@ -27,7 +27,8 @@
 // etc.)
 class NodeBase {
 private:
-  // fields could go here
+  long m_ival;   // value of an integer literal
+  int m_sym;     // symbol id of an identifier
 
   // copy ctor and assignment operator not supported
   NodeBase(const NodeBase &);
@@ -36,6 +37,12 @@ private:
 public:
   NodeBase();
   virtual ~NodeBase();  
+
+  long get_ival() const { return m_ival; }
+  void set_ival(long ival) { m_ival = ival; }
+
+  int get_sym() const { return m_sym; }
+  void set_sym(int sym) { m_sym = sym; }
 };
 
 #endif // NODE_BASE_H
@@ -0,0 +1,338 @@
+#include <thread>
+#include <algorithm>
+#include "exceptions.h"
+#include "parallel.h"
+
+namespace {
+
+const unsigned NO_STMT = ~0u;
+
+// number of times an idle worker looks for work before sleeping
+const unsigned IDLE_SPINS = 64;
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// ParallelExecutor implementation
+////////////////////////////////////////////////////////////////////////
+
+ParallelExecutor::ParallelExecutor(const FlatAst *ast, Environment *env, unsigned num_threads)
+  : m_ast(ast)
+  , m_env(env)
+  , m_num_threads(num_threads)
+  , m_critical_path(0)
+  , m_fork_depth(0)
+  , m_num_remaining(0)
+  , m_num_queued(0)
+  , m_num_sleeping(0)
+  , m_result(-1)
+  , m_error_stmt(NO_STMT) {
+  if (m_num_threads == 0) {
+    m_num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  while ((1u << m_fork_depth) < m_num_threads) {
+    m_fork_depth++;
+  }
+}
+
+ParallelExecutor::~ParallelExecutor() {
+}
+
+long ParallelExecutor::exec() {
+  unsigned num_stmts = m_ast->get_num_statements();
+
+  // slots must be resolved before the workers access them
+  m_env->resolve_slots();
+  build_graph();
+  if (m_fork_depth > 0) {
+    Interpreter::count_assigns(*m_ast, m_assigns);
+  }
+
+  m_pending.reset(new std::atomic<unsigned>[num_stmts]);
+  m_queues.clear();
+  for (unsigned i = 0; i < m_num_threads; i++) {
+    m_queues.emplace_back(new WorkQueue());
+  }
+
+  // distribute the initially ready statements among the workers
+  unsigned next = 0;
+  for (unsigned i = 0; i < num_stmts; i++) {
+    m_pending[i].store(m_num_preds[i], std::memory_order_relaxed);
+    if (m_num_preds[i] == 0) {
+      m_queues[next]->work.push_back({ i, nullptr });
+      m_num_queued++;
+      next = (next + 1) % m_num_threads;
+    }
+  }
+  m_num_remaining = num_stmts;
+  m_error_stmt = NO_STMT;
+  m_error = nullptr;
+
+  // the calling thread is worker 0
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < m_num_threads; i++) {
+    threads.emplace_back(&ParallelExecutor::worker, this, i);
+  }
+  worker(0);
+  for (auto i = threads.begin(); i != threads.end(); ++i) {
+    i->join();
+  }
+
+  if (m_error) {
+    std::rethrow_exception(m_error);
+  }
+  return m_result;
+}
+
+void ParallelExecutor::print_stats(FILE *out) const {
+  fprintf(out, "parallel: %u statements, %u dependencies, critical path %u statements, %u threads\n",
+          m_ast->get_num_statements(), unsigned(m_succ.size()), m_critical_path, m_num_threads);
+}
+
+// Find the dependencies between statements.  Since every dependency is
+// on an earlier statement, the statements in order are a topological
+// order of the graph, which also makes it easy to find the length of
+// the longest chain of dependent statements.
+void ParallelExecutor::build_graph() {
+  unsigned num_stmts = m_ast->get_num_statements();
+  unsigned num_slots = m_env->get_num_slots();
+
+  // per slot: last statement assigning it, and statements which
+  // read it since then
+  std::vector<unsigned> last_writer(num_slots, NO_STMT);
+  std::vector<std::vector<unsigned>> readers(num_slots);
+
+  // per slot: last statement which read/assigned it, to
+  // ignore repeated references within a statement
+  std::vector<unsigned> read_by(num_slots, NO_STMT), written_by(num_slots, NO_STMT);
+  std::vector<unsigned> seen_pred(num_stmts, NO_STMT);
+
+  std::vector<unsigned> reads, writes;
+  std::vector<std::pair<unsigned, unsigned>> edges;   // (pred, succ)
+  std::vector<unsigned> depth(num_stmts, 1);
+
+  m_num_preds.assign(num_stmts, 0);
+  m_critical_path = 0;
+
+  for (unsigned stmt = 0; stmt < num_stmts; stmt++) {
+    reads.clear();
+    writes.clear();
+    unsigned end = m_ast->get_statement_end(stmt);
+    for (unsigned i = m_ast->get_statement(stmt); i < end; i++) {
+      unsigned slot = unsigned(m_ast->get_payload(i));
+      if (m_ast->get_op(i) == AST_VAR && read_by[slot] != stmt) {
+        read_by[slot] = stmt;
+        reads.push_back(slot);
+      } else if (m_ast->get_op(i) == AST_ASSIGN && written_by[slot] != stmt) {
+        written_by[slot] = stmt;
+        writes.push_back(slot);
+      }
+    }
+
+    auto add_edge = [&](unsigned pred) {
+      if (pred != NO_STMT && pred != stmt && seen_pred[pred] != stmt) {
+        seen_pred[pred] = stmt;
+        edges.push_back({ pred, stmt });
+        m_num_preds[stmt]++;
+        depth[stmt] = std::max(depth[stmt], depth[pred] + 1);
+      }
+    };
+
+    for (auto i = reads.begin(); i != reads.end(); ++i) {
+      add_edge(last_writer[*i]);
+    }
+    for (auto i = writes.begin(); i != writes.end(); ++i) {
+      add_edge(last_writer[*i]);
+      for (auto j = readers[*i].begin(); j != readers[*i].end(); ++j) {
+        add_edge(*j);
+      }
+    }
+
+    for (auto i = writes.begin(); i != writes.end(); ++i) {
+      last_writer[*i] = stmt;
+      readers[*i].clear();
+    }
+    for (auto i = reads.begin(); i != reads.end(); ++i) {
+      if (written_by[*i] != stmt) {
+        readers[*i].push_back(stmt);
+      }
+    }
+
+    m_critical_path = std::max(m_critical_path, depth[stmt]);
+  }
+
+  // convert the edges to lists of successors
+  m_succ_start.assign(num_stmts + 1, 0);
+  for (auto i = edges.begin(); i != edges.end(); ++i) {
+    m_succ_start[i->first + 1]++;
+  }
+  for (unsigned i = 0; i < num_stmts; i++) {
+    m_succ_start[i + 1] += m_succ_start[i];
+  }
+  m_succ.resize(edges.size());
+  std::vector<unsigned> fill(m_succ_start.begin(), m_succ_start.end() - 1);
+  for (auto i = edges.begin(); i != edges.end(); ++i) {
+    m_succ[fill[i->first]++] = i->second;
+  }
+}
+
+void ParallelExecutor::fork(unsigned worker, ForkTask *task) {
+  push(worker, { NO_STMT, task });
+}
+
+void ParallelExecutor::join(unsigned worker, ForkTask *task) {
+  // Forked tasks are joined in the reverse of the order they were
+  // forked, so if no other worker has taken the task, it is at the
+  // back of the worker's queue
+  bool queued = false;
+  {
+    WorkQueue &q = *m_queues[worker];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.work.empty() && q.work.back().task == task) {
+      q.work.pop_back();
+      m_num_queued--;
+      queued = true;
+    }
+  }
+  if (queued) {
+    Interpreter::run_fork_task(task, worker);
+    return;
+  }
+
+  // another worker is running the task: help with other work
+  while (!task->done.load(std::memory_order_acquire)) {
+    Work work;
+    if (take(worker, work)) {
+      run_work(worker, work);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ParallelExecutor::worker(unsigned id) {
+  unsigned spins = 0;
+
+  while (m_num_remaining.load(std::memory_order_acquire) > 0) {
+    Work work;
+    if (!take(id, work)) {
+      if (++spins < IDLE_SPINS) {
+        std::this_thread::yield();
+      } else {
+        sleep();
+        spins = 0;
+      }
+      continue;
+    }
+    spins = 0;
+    run_work(id, work);
+  }
+}
+
+// Run a forked operand, or a statement (followed by the statements
+// which become ready as a result, which are run immediately, without
+// going through the queue)
+void ParallelExecutor::run_work(unsigned id, const Work &work) {
+  if (work.task != nullptr) {
+    Interpreter::run_fork_task(work.task, id);
+    return;
+  }
+
+  Interpreter interp(m_ast, m_env);
+  interp.set_fork_join(m_fork_depth, this, id, &m_assigns);
+  unsigned stmt = work.stmt;
+  do {
+    stmt = run(stmt, id, interp);
+  } while (stmt != NO_STMT);
+}
+
+// Run a statement, and mark it as done.  Returns one of the statements
+// which became ready as a result (the others are queued), or NO_STMT.
+unsigned ParallelExecutor::run(unsigned stmt, unsigned id, Interpreter &interp) {
+  // Once a statement has raised an error, later statements don't need
+  // to be run, since sequential execution would have stopped.  They
+  // must still be marked as done, though.
+  if (stmt < m_error_stmt.load(std::memory_order_relaxed)) {
+    try {
+      long value = interp.eval_statement(stmt);
+      if (stmt == m_ast->get_num_statements() - 1) {
+        m_result = value;
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(m_error_lock);
+      if (stmt < m_error_stmt.load(std::memory_order_relaxed)) {
+        m_error_stmt.store(stmt, std::memory_order_relaxed);
+        m_error = std::current_exception();
+      }
+    }
+  }
+
+  unsigned next = NO_STMT;
+  for (unsigned i = m_succ_start[stmt]; i < m_succ_start[stmt + 1]; i++) {
+    unsigned succ = m_succ[i];
+    if (m_pending[succ].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      if (next == NO_STMT) {
+        next = succ;
+      } else {
+        push(id, { succ, nullptr });
+      }
+    }
+  }
+
+  if (m_num_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // everything is done: wake up the sleeping workers so they can exit
+    std::lock_guard<std::mutex> guard(m_sleep_lock);
+    m_wakeup.notify_all();
+  }
+
+  return next;
+}
+
+void ParallelExecutor::push(unsigned id, const Work &work) {
+  {
+    std::lock_guard<std::mutex> guard(m_queues[id]->lock);
+    m_queues[id]->work.push_back(work);
+  }
+  m_num_queued++;
+
+  if (m_num_sleeping > 0) {
+    std::lock_guard<std::mutex> guard(m_sleep_lock);
+    m_wakeup.notify_one();
+  }
+}
+
+// Take ready work from the worker's own queue, or else steal it from
+// another worker's queue
+bool ParallelExecutor::take(unsigned id, Work &work) {
+  if (m_num_queued.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  for (unsigned n = 0; n < m_num_threads; n++) {
+    WorkQueue &q = *m_queues[(id + n) % m_num_threads];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (!q.work.empty()) {
+      if (n == 0) {
+        work = q.work.back();
+        q.work.pop_back();
+      } else {
+        work = q.work.front();
+        q.work.pop_front();
+      }
+      m_num_queued--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Wait until there is queued work or everything is done
+void ParallelExecutor::sleep() {
+  std::unique_lock<std::mutex> guard(m_sleep_lock);
+  m_num_sleeping++;
+  while (m_num_queued == 0 && m_num_remaining > 0) {
+    m_wakeup.wait(guard);
+  }
+  m_num_sleeping--;
+}
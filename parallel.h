@@ -0,0 +1,105 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstdio>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include "ast.h"
+#include "env.h"
+#include "interp.h"
+
+// Executes the statements of a unit concurrently on a pool of threads.
+// Statements only interact through variables, so the variables each
+// statement reads and assigns determine which statements must be
+// executed in order: a statement must follow the last earlier statement
+// assigning a variable it reads or assigns, and every statement since
+// then which read a variable it assigns.  Statements become ready when
+// all of the statements they depend on are done, and each thread keeps
+// its own queue of ready statements, stealing from other threads'
+// queues when its queue is empty.
+//
+// A statement which is large enough is itself evaluated by several
+// threads (see Interpreter::set_fork_join): the operands it forks are
+// put in the same queues as ready statements, and a thread waiting to
+// join an operand which another thread took runs other work meanwhile.
+//
+// The final variable values and result are the same as for sequential
+// execution.  If statements raise errors, the error raised by the
+// earliest such statement is the one reported, which is the error
+// sequential execution would have raised.
+class ParallelExecutor : public ForkScheduler {
+private:
+  // A ready statement, or a forked operand (if task isn't null)
+  struct Work {
+    unsigned stmt;
+    ForkTask *task;
+  };
+
+  // Ready work of one worker: the owner takes work from the back, and
+  // other workers steal from the front
+  struct alignas(64) WorkQueue {
+    std::mutex lock;
+    std::deque<Work> work;
+  };
+
+  const FlatAst *m_ast;
+  Environment *m_env;
+  unsigned m_num_threads;
+
+  // dependency graph: successors of statement i are
+  // m_succ[m_succ_start[i] .. m_succ_start[i+1]-1]
+  std::vector<unsigned> m_succ, m_succ_start;
+  std::vector<unsigned> m_num_preds;
+  unsigned m_critical_path;
+
+  // for fork-join evaluation of large statements
+  unsigned m_fork_depth;
+  std::vector<unsigned> m_assigns;
+
+  // execution state
+  std::unique_ptr<std::atomic<unsigned>[]> m_pending;   // unfinished predecessors
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;
+  std::atomic<unsigned> m_num_remaining;                // statements not done
+  std::atomic<unsigned> m_num_queued;
+  std::atomic<unsigned> m_num_sleeping;
+  std::mutex m_sleep_lock;
+  std::condition_variable m_wakeup;
+  long m_result;
+
+  // earliest statement which raised an error, and the error
+  std::atomic<unsigned> m_error_stmt;
+  std::exception_ptr m_error;
+  std::mutex m_error_lock;
+
+  // no value semantics
+  ParallelExecutor(const ParallelExecutor &);
+  ParallelExecutor &operator=(const ParallelExecutor &);
+
+public:
+  // A num_threads value of 0 means to use one thread per CPU
+  ParallelExecutor(const FlatAst *ast, Environment *env, unsigned num_threads);
+  ~ParallelExecutor();
+
+  long exec();
+
+  void print_stats(FILE *out) const;
+
+  virtual void fork(unsigned worker, ForkTask *task);
+  virtual void join(unsigned worker, ForkTask *task);
+
+private:
+  void build_graph();
+  void worker(unsigned id);
+  void run_work(unsigned id, const Work &work);
+  unsigned run(unsigned stmt, unsigned id, Interpreter &interp);
+  void push(unsigned id, const Work &work);
+  bool take(unsigned id, Work &work);
+  void sleep();
+};
+
+#endif // PARALLEL_H
@@ -1,5 +1,5 @@
 #include <string>
-#include <memory>
+#include <vector>
 #include "cpputil.h"
 #include "treeprint.h"
 #include "token.h"
@@ -21,9 +21,14 @@
 // E -> * E E
 // E -> / E E
 // E -> = identifier E
+//
+// Note that the right recursion in the U productions is not reflected
+// in the parse tree: a U node's children are the flat sequence of
+// E and ; nodes for all of the statements in the unit.
 
-Parser::Parser(Lexer *lexer_to_adopt)
+Parser::Parser(Lexer *lexer_to_adopt, NodeArena *arena)
   : m_lexer(lexer_to_adopt)
+  , m_arena(arena)
   , m_next(nullptr) {
 }
 
@@ -36,66 +41,129 @@ Node *Parser::parse() {
   return parse_U();
 }
 
-Node *Parser::parse_U() {
-  std::unique_ptr<Node> u(new Node(NODE_U));
-
+Node *Parser::parse_statement() {
   // U -> ^ E ;
   // U -> ^ E ; U
-  u->append_kid(parse_E());
-  u->append_kid(expect(TOK_SEMICOLON));
-
-  // U -> E ; ^
-  // U -> E ; ^ U
-  if (m_lexer->peek() != nullptr) {
-    // there is more input, so the sequence of expressions continues
-    u->append_kid(parse_U());
+  Node *e = parse_E();
+  expect(TOK_SEMICOLON);
+  return e;
+}
+
+bool Parser::at_end() {
+  return m_lexer->peek().kind == TOK_EOF;
+}
+
+void Parser::discard_line_info() {
+  m_lexer->discard_line_info();
+}
+
+Node *Parser::parse_U() {
+  Node *u = new (m_arena) Node(m_arena, NODE_U);
+
+  // Rather than recursing for each E ; in the sequence, parse
+  // them iteratively, so there is no limit on the number of statements
+  for (;;) {
+    // U -> ^ E ;
+    // U -> ^ E ; U
+    u->append_kid(parse_E());
+    u->append_kid(expect(TOK_SEMICOLON));
+
+    // U -> E ; ^
+    // U -> E ; ^ U
+    if (m_lexer->peek().kind == TOK_EOF) {
+      // no more input, so the sequence of expressions is done
+      break;
+    }
   }
 
-  return u.release();
+  return u;
 }
 
 Node *Parser::parse_E() {
-  // read the next terminal symbol
-  Node *next_terminal = m_lexer->next();
-
-  std::unique_ptr<Node> e(new Node(NODE_E));
-
-  int tag = next_terminal->get_tag();
-  if (tag == TOK_INTEGER_LITERAL || tag == TOK_IDENTIFIER) {
-    // E -> <int_literal> ^
-    // E -> <identifier> ^
-    e->append_kid(next_terminal);
-  } else if (tag == TOK_ASSIGN) {
-    // E -> = ^ <identifier> E
-    e->append_kid(next_terminal);
-    e->append_kid(expect(TOK_IDENTIFIER));
-    e->append_kid(parse_E());
-  } else if (tag == TOK_PLUS || tag == TOK_MINUS || tag == TOK_TIMES || tag == TOK_DIVIDE) {
-    // E -> + ^ E E
-    // E -> - ^ E E
-    // E -> * ^ E E
-    // E -> / ^ E E
-
-    e->append_kid(next_terminal);
-
-    e->append_kid(parse_E()); // parse first operand
-    e->append_kid(parse_E()); // parse second operand
-  } else {
-    SyntaxError::raise(next_terminal->get_loc(), "Illegal expression (at '%s')", next_terminal->get_str().c_str());
+  // Rather than recursing for each operand, E is parsed iteratively.
+  // The stack holds the E nodes which are still waiting for operands:
+  // each new E node becomes the next operand of the E node on top of
+  // the stack.  (If an error occurs, the partially-built tree is
+  // simply left in the arena.)
+  Node *root = nullptr;
+  std::vector<Node *> stack;
+
+  for (;;) {
+    // read the next terminal symbol
+    Token next_terminal = m_lexer->next();
+
+    int tag = next_terminal.kind;
+    bool is_leaf = (tag == TOK_INTEGER_LITERAL || tag == TOK_IDENTIFIER);
+    bool is_assign = (tag == TOK_ASSIGN);
+    bool is_binary = (tag == TOK_PLUS || tag == TOK_MINUS || tag == TOK_TIMES || tag == TOK_DIVIDE);
+    if (!is_leaf && !is_assign && !is_binary) {
+      SyntaxError::raise(m_lexer->get_loc(next_terminal), "Illegal expression (at '%.*s')",
+                         int(next_terminal.len), next_terminal.lexeme);
+    }
+
+    Node *e = new (m_arena) Node(m_arena, NODE_E);
+    if (stack.empty()) {
+      root = e;
+    } else {
+      stack.back()->append_kid(e);
+    }
+
+    if (is_leaf) {
+      // E -> <int_literal> ^
+      // E -> <identifier> ^
+      e->append_kid(token_node(next_terminal));
+    } else if (is_assign) {
+      // E -> = ^ <identifier> E
+      e->append_kid(token_node(next_terminal));
+      e->append_kid(expect(TOK_IDENTIFIER));
+      stack.push_back(e);
+    } else {
+      // E -> + ^ E E
+      // E -> - ^ E E
+      // E -> * ^ E E
+      // E -> / ^ E E
+      e->append_kid(token_node(next_terminal));
+      stack.push_back(e);
+    }
+
+    // E nodes with all of their operands (an operator or assignment
+    // plus 2 children) are complete
+    while (!stack.empty() && stack.back()->get_num_kids() == 3) {
+      stack.pop_back();
+    }
+
+    if (stack.empty()) {
+      return root;
+    }
   }
-
-  return e.release();
 }
 
 Node *Parser::expect(enum TokenKind tok_kind) {
-  std::unique_ptr<Node> next_terminal(m_lexer->next());
-  if (next_terminal == nullptr) {
-    error_at_current_pos("Unexpected end of input");
+  Token next_terminal = m_lexer->next();
+  if (next_terminal.kind != tok_kind) {
+    SyntaxError::raise(m_lexer->get_loc(next_terminal), "Unexpected token '%.*s'",
+                       int(next_terminal.len), next_terminal.lexeme);
   }
-  if (next_terminal->get_tag() != tok_kind) {
-    SyntaxError::raise(next_terminal->get_loc(), "Unexpected token '%s'", next_terminal->get_str().c_str());
+  return token_node(next_terminal);
+}
+
+// Tokens are only turned into Nodes when they become part of the
+// parse tree.  Identifiers are represented by their symbol id.  For
+// other tokens, the lexeme must be copied, since the token doesn't
+// own it.
+Node *Parser::token_node(const Token &tok) {
+  Node *n;
+  if (tok.kind == TOK_IDENTIFIER) {
+    n = new (m_arena) Node(m_arena, tok.kind);
+    n->set_sym(tok.sym);
+  } else {
+    n = new (m_arena) Node(m_arena, tok.kind, std::string(tok.lexeme, tok.len));
+    if (tok.kind == TOK_INTEGER_LITERAL) {
+      n->set_ival(tok.value);
+    }
   }
-  return next_terminal.release();
+  n->set_loc(m_lexer->get_loc(tok));
+  return n;
 }
 
 void Parser::error_at_current_pos(const std::string &msg) {
@@ -106,7 +174,8 @@ void Parser::error_at_current_pos(const std::string &msg) {
 // ParserTreePrint implementation
 ////////////////////////////////////////////////////////////////////////
 
-ParserTreePrint::ParserTreePrint() {
+ParserTreePrint::ParserTreePrint(const SymbolTable *symtab)
+  : m_symtab(symtab) {
 }
 
 ParserTreePrint::~ParserTreePrint() {
@@ -131,6 +200,8 @@ std::string ParserTreePrint::node_tag_to_string(int tag) const {
     return "ASSIGN";
   case TOK_SEMICOLON:
     return "SEMICOLON";
+  case TOK_EOF:
+    return "EOF";
 
   // nonterminal symbols:
   case NODE_U:
@@ -142,3 +213,11 @@ std::string ParserTreePrint::node_tag_to_string(int tag) const {
     RuntimeError::raise("Unknown node tag: %d", tag);
   }
 }
+
+std::string ParserTreePrint::node_str(Node *n) const {
+  // identifiers are printed using their name from the symbol table
+  if (n->get_tag() == TOK_IDENTIFIER && m_symtab != nullptr && n->get_sym() >= 0) {
+    return m_symtab->get_name(unsigned(n->get_sym()));
+  }
+  return TreePrint::node_str(n);
+}
@@ -3,6 +3,7 @@
 
 #include "lexer.h"
 #include "node.h"
+#include "symtab.h"
 #include "treeprint.h"
 
 // Enumeration to define the nonterminal symbols:
@@ -17,14 +18,29 @@ enum Nonterminal {
 class Parser {
 private:
   Lexer *m_lexer;
+  NodeArena *m_arena;
   Node *m_next;
 
 public:
-  Parser(Lexer *lexer_to_adopt);
+  // Parse tree nodes are allocated from the given arena, and
+  // remain valid until the arena is cleared or destroyed.
+  Parser(Lexer *lexer_to_adopt, NodeArena *arena);
   ~Parser();
 
   Node *parse();
 
+  // Functions for parsing one statement at a time: parse_statement
+  // parses a single E ; and returns the E node, and at_end returns
+  // true once all of the statements have been parsed.
+  Node *parse_statement();
+  bool at_end();
+
+  // Discard line information for input which has already been
+  // parsed, so that memory use stays bounded when parsing an
+  // unlimited number of statements.  Line numbers can no longer
+  // be reported for statements which have already been parsed.
+  void discard_line_info();
+
 private:
   // Parse functions for nonterminal grammar symbols
   Node *parse_U();
@@ -33,16 +49,23 @@ private:
   // Consume a specific token, wrapping it in a Node
   Node *expect(enum TokenKind tok_kind);
 
+  // Create a Node to represent a token in the parse tree
+  Node *token_node(const Token &tok);
+
   // Report an error at current lexer position
   void error_at_current_pos(const std::string &msg);
 };
 
 class ParserTreePrint : public TreePrint {
+private:
+  const SymbolTable *m_symtab;
+
 public:
-  ParserTreePrint();
+  ParserTreePrint(const SymbolTable *symtab = nullptr);
   virtual ~ParserTreePrint();
 
   virtual std::string node_tag_to_string(int tag) const;
+  virtual std::string node_str(Node *n) const;
 };
 
 #endif // PARSER_H
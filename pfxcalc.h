@@ -0,0 +1,127 @@
+#ifndef PFXCALC_H
+#define PFXCALC_H
+
+#include <stddef.h>
+
+/*
+ * C API for embedding pfxcalc.
+ *
+ * A program is compiled once, producing a pfx_program, which is never
+ * modified afterwards, so it can be shared by any number of threads.
+ * Each evaluation uses a pfx_env, which holds the values of the
+ * program's variables: a thread evaluating the program needs its own
+ * pfx_env, but an environment is small, and can be reused for many
+ * evaluations.  Variables keep their values from one evaluation to the
+ * next, so the usual pattern is to set the input variables, evaluate,
+ * and get the output variables:
+ *
+ *   pfx_program *prog;
+ *   pfx_error err;
+ *   if (pfx_compile(text, strlen(text), 0, &prog, &err) != PFX_OK) {
+ *     fprintf(stderr, "formula:%d: %s\n", err.line, err.message);
+ *     return;
+ *   }
+ *   pfx_env *env = pfx_env_create(prog);
+ *   pfx_set(env, "price", 100);
+ *   long result;
+ *   if (pfx_eval(prog, env, &result, &err) == PFX_OK) ...
+ *
+ * Functions report errors by returning an error code (PFX_OK for
+ * success); no exceptions escape from the library.  If the err
+ * argument isn't NULL, it is filled in with a description of the error.
+ * A NULL program, environment, or name is an invalid argument: functions
+ * returning an error code return PFX_ERR_INVALID, pfx_num_vars returns
+ * 0, pfx_var_name and pfx_env_create return NULL, pfx_var_index returns
+ * -1, and the functions which free or reset do nothing.
+ */
+
+/* The library is built with hidden symbol visibility: only the
+   functions declared here are exported. */
+#if defined(__GNUC__)
+#  define PFX_API __attribute__ ((visibility ("default")))
+#else
+#  define PFX_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+  PFX_OK = 0,
+  PFX_ERR_SYNTAX,       /* program text is invalid */
+  PFX_ERR_UNDEFINED,    /* variable used before it was given a value */
+  PFX_ERR_DIV_ZERO,     /* division by zero */
+  PFX_ERR_NO_VAR,       /* program has no variable with the given name */
+  PFX_ERR_INVALID,      /* invalid argument */
+  PFX_ERR_NOMEM,        /* out of memory */
+  PFX_ERR_INTERNAL,     /* anything else */
+};
+
+/* compile flags */
+enum {
+  PFX_FOLD = 1,         /* fold constants (same as pfxcalc -O) */
+  PFX_INCREMENTAL = 2,  /* support pfx_update */
+};
+
+typedef struct pfx_program pfx_program;
+typedef struct pfx_env pfx_env;
+
+typedef struct pfx_error {
+  int code;             /* error code */
+  int line, col;        /* location in the program text (0 if none) */
+  char message[256];
+} pfx_error;
+
+/* Compile program text (len bytes).  On success, *prog is set to the
+   compiled program. */
+PFX_API int pfx_compile(const char *text, size_t len, unsigned flags,
+                        pfx_program **prog, pfx_error *err);
+PFX_API void pfx_program_free(pfx_program *prog);
+
+/* Variables of a program, indexed 0..pfx_num_vars(prog)-1 */
+PFX_API unsigned pfx_num_vars(const pfx_program *prog);
+PFX_API const char *pfx_var_name(const pfx_program *prog, unsigned index);
+PFX_API int pfx_var_index(const pfx_program *prog, const char *name);   /* -1 if none */
+
+/* Create an environment for evaluating a program, with no variables
+   set.  Returns NULL if out of memory. */
+PFX_API pfx_env *pfx_env_create(const pfx_program *prog);
+PFX_API void pfx_env_free(pfx_env *env);
+
+/* Forget the values of all variables */
+PFX_API void pfx_env_reset(pfx_env *env);
+
+PFX_API int pfx_set(pfx_env *env, const char *name, long value);
+PFX_API int pfx_set_index(pfx_env *env, unsigned index, long value);
+PFX_API int pfx_get(const pfx_env *env, const char *name, long *value);
+PFX_API int pfx_get_index(const pfx_env *env, unsigned index, long *value);
+
+/* Evaluate a program in an environment created for it, storing the
+   value of its last statement in *result */
+PFX_API int pfx_eval(const pfx_program *prog, pfx_env *env, long *result, pfx_error *err);
+
+/* Change the input value of a variable and update the result of the
+   program, re-evaluating only the statements affected by the change
+   (the program must have been compiled with PFX_INCREMENTAL).  The
+   first update in an environment evaluates the whole program, using
+   the values of the variables (as set by pfx_set) as the inputs; after
+   that, each update only costs as much as the part of the program it
+   affects.  Setting variables with pfx_set, resetting the environment,
+   or evaluating with pfx_eval starts over with a full evaluation.
+   The result, error, and variable values are the same as for pfx_eval:
+   if a statement fails, the variables have the values they had when
+   it failed. */
+PFX_API int pfx_update(const pfx_program *prog, pfx_env *env, const char *name, long value,
+                       long *result, pfx_error *err);
+PFX_API int pfx_update_index(const pfx_program *prog, pfx_env *env, unsigned index, long value,
+                             long *result, pfx_error *err);
+
+/* Description of an error code */
+PFX_API const char *pfx_strerror(int code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFXCALC_H */
@@ -0,0 +1,98 @@
+// Client for a pfxcalc server (pfxcalc --serve socket).
+// Evaluates each file (or standard input) as a separate request on
+// the same connection, so variables assigned by one program can be
+// used by the next.
+//
+// Usage: pfxclient [-D name=value]... [-g name]... socket [file...]
+//   -D  bind a variable before evaluating the first program
+//   -g  print the value of a variable after evaluating the programs
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "exceptions.h"
+#include "client.h"
+
+namespace {
+
+std::string read_file(FILE *in) {
+  std::string text;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+    text.append(buf, n);
+  }
+  return text;
+}
+
+// Print a response, returning false if it is an error
+bool print_response(const std::string &response, const char *prefix) {
+  if (response.compare(0, 6, "ERROR ") == 0) {
+    fprintf(stderr, "Error: %s\n", response.c_str() + 6);
+    return false;
+  }
+  size_t space = response.find(' ');
+  printf("%s%s\n", prefix, space == std::string::npos ? response.c_str() : response.c_str() + space + 1);
+  return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> bindings, gets;
+  int opt;
+  while ((opt = getopt(argc, argv, "D:g:")) != -1) {
+    switch (opt) {
+    case 'D':
+      bindings.push_back(optarg);
+      break;
+    case 'g':
+      gets.push_back(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: pfxclient [-D name=value]... [-g name]... socket [file...]\n");
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: pfxclient [-D name=value]... [-g name]... socket [file...]\n");
+    return 1;
+  }
+
+  try {
+    Client client(argv[optind]);
+    bool ok = true;
+
+    std::vector<const char *> files(argv + optind + 1, argv + argc);
+    if (files.empty() && gets.empty()) {
+      files.push_back(nullptr);   // standard input
+    }
+
+    for (auto i = files.begin(); i != files.end() && ok; ++i) {
+      FILE *in = stdin;
+      if (*i != nullptr) {
+        in = fopen(*i, "r");
+        if (!in) {
+          RuntimeError::raise("Could not open input file '%s'", *i);
+        }
+      }
+      std::string program = read_file(in);
+      if (in != stdin) {
+        fclose(in);
+      }
+
+      ok = print_response(client.eval(program, bindings), "Result: ");
+      bindings.clear();
+    }
+
+    for (auto i = gets.begin(); i != gets.end() && ok; ++i) {
+      ok = print_response(client.request("GET " + *i), (*i + " = ").c_str());
+    }
+
+    return ok ? 0 : 1;
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+}
@@ -0,0 +1,115 @@
+// Load generator for a pfxcalc server (pfxcalc --serve socket).
+// Each of several connections sends requests one after another, and
+// the latency of each request is recorded.  Prints the throughput and
+// latency percentiles.
+//
+// Usage: pfxload [-c connections] [-n requests] [-e program] socket
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include "exceptions.h"
+#include "client.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Send requests on one connection, recording the latency of each
+// (in microseconds) and the number of requests which completed (if
+// the connection fails, the rest aren't sent).  Each request binds a
+// different value, so the results vary.
+void run_connection(const char *path, const std::string &program, unsigned num_requests,
+                    double *latencies, unsigned *num_done, unsigned *num_errors) {
+  try {
+    Client client(path);
+    for (unsigned i = 0; i < num_requests; i++) {
+      std::vector<std::string> bindings(1, "n=" + std::to_string(i));
+      Clock::time_point start = Clock::now();
+      std::string response = client.eval(program, bindings);
+      std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+      latencies[i] = elapsed.count();
+      (*num_done)++;
+      if (response.compare(0, 7, "RESULT ") != 0) {
+        (*num_errors)++;
+      }
+    }
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+  }
+}
+
+double percentile(const std::vector<double> &sorted, double p) {
+  size_t index = size_t(p / 100.0 * double(sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+}
+
+int main(int argc, char **argv) {
+  unsigned num_connections = 8, num_requests = 10000;
+  std::string program = "= x * + n 1 3; / x 2;";
+  int opt;
+  while ((opt = getopt(argc, argv, "c:n:e:")) != -1) {
+    switch (opt) {
+    case 'c':
+      num_connections = std::max(1, atoi(optarg));
+      break;
+    case 'n':
+      num_requests = std::max(1, atoi(optarg));
+      break;
+    case 'e':
+      program = optarg;
+      break;
+    default:
+      fprintf(stderr, "Usage: pfxload [-c connections] [-n requests] [-e program] socket\n");
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: pfxload [-c connections] [-n requests] [-e program] socket\n");
+    return 1;
+  }
+  const char *path = argv[optind];
+
+  std::vector<double> latencies(size_t(num_connections) * num_requests);
+  std::vector<unsigned> done(num_connections, 0), errors(num_connections, 0);
+  std::vector<std::thread> threads;
+
+  Clock::time_point start = Clock::now();
+  for (unsigned i = 0; i < num_connections; i++) {
+    threads.emplace_back(run_connection, path, program, num_requests,
+                         latencies.data() + size_t(i) * num_requests, &done[i], &errors[i]);
+  }
+  for (auto i = threads.begin(); i != threads.end(); ++i) {
+    i->join();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  // only the latencies of completed requests count
+  std::vector<double> completed;
+  unsigned long total_errors = 0;
+  for (unsigned i = 0; i < num_connections; i++) {
+    const double *conn_latencies = latencies.data() + size_t(i) * num_requests;
+    completed.insert(completed.end(), conn_latencies, conn_latencies + done[i]);
+    total_errors += errors[i];
+  }
+  unsigned long num_failed = (unsigned long) latencies.size() - completed.size();
+
+  std::sort(completed.begin(), completed.end());
+  printf("%lu requests on %u connections in %.3f s (%.0f requests/s), %lu errors, %lu not sent\n",
+         (unsigned long) completed.size(), num_connections, elapsed.count(),
+         double(completed.size()) / elapsed.count(), total_errors, num_failed);
+  if (!completed.empty()) {
+    printf("latency (us): p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           percentile(completed, 50), percentile(completed, 90),
+           percentile(completed, 99), completed.back());
+  }
+
+  return (total_errors > 0 || num_failed > 0) ? 1 : 0;
+}
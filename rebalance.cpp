@@ -0,0 +1,114 @@
+#include "rebalance.h"
+
+namespace {
+
+// chains with fewer terms than this are left alone, since rebalancing
+// wouldn't make them any shallower
+const unsigned MIN_TERMS = 4;
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// ChainRebalancer implementation
+////////////////////////////////////////////////////////////////////////
+
+ChainRebalancer::ChainRebalancer()
+  : m_num_chains(0)
+  , m_num_terms(0) {
+}
+
+ChainRebalancer::~ChainRebalancer() {
+}
+
+void ChainRebalancer::rebalance(const FlatAst &in, FlatAst &out) {
+  unsigned num_stmts = in.get_num_statements();
+  for (unsigned i = 0; i < num_stmts; i++) {
+    rebalance_statement(in, i, out);
+  }
+}
+
+// The statement is copied in preorder.  When an addition or
+// multiplication is encountered, it is the root of a chain (since the
+// operators inside a chain are never copied), so its terms are
+// collected, and if there are enough of them, a balanced tree of the
+// terms is emitted in place of the chain.
+unsigned ChainRebalancer::rebalance_statement(const FlatAst &in, unsigned stmt, FlatAst &out) {
+  unsigned result = out.begin_statement();
+  m_terms.clear();
+  m_stack.clear();
+  m_stack.push_back({ in.get_statement(stmt), 0, 0, FlatAst::NO_NODE });
+
+  while (!m_stack.empty()) {
+    Item item = m_stack.back();
+    m_stack.pop_back();
+
+    if (item.lo == item.hi) {
+      AstOp op = in.get_op(item.node);
+      if ((op == AST_ADD || op == AST_MUL) && collect_terms(in, item.node)) {
+        // the terms are at the end of m_terms
+        item.lo = unsigned(m_terms.size() - m_work.size());
+        item.hi = unsigned(m_terms.size());
+        m_stack.push_back(item);
+        continue;
+      }
+
+      unsigned index = out.add_node(op, in.get_payload(item.node), in.get_loc(item.node));
+      if (item.parent != FlatAst::NO_NODE) {
+        out.set_right(item.parent, index);
+      }
+      if (FlatAst::is_binary(op)) {
+        m_stack.push_back({ in.get_right(item.node), 0, 0, index });
+      }
+      if (FlatAst::is_binary(op) || op == AST_ASSIGN) {
+        m_stack.push_back({ item.node + 1, 0, 0, FlatAst::NO_NODE });
+      }
+    } else if (item.hi - item.lo == 1) {
+      m_stack.push_back({ m_terms[item.lo], 0, 0, item.parent });
+    } else {
+      unsigned mid = item.lo + (item.hi - item.lo) / 2;
+      unsigned index = out.add_node(in.get_op(item.node), 0, in.get_loc(item.node));
+      if (item.parent != FlatAst::NO_NODE) {
+        out.set_right(item.parent, index);
+      }
+      m_stack.push_back({ item.node, mid, item.hi, index });
+      m_stack.push_back({ item.node, item.lo, mid, FlatAst::NO_NODE });
+    }
+  }
+
+  return result;
+}
+
+void ChainRebalancer::print_stats(FILE *out) const {
+  fprintf(out, "rebalance: %lu chains of %lu terms rebalanced\n", m_num_chains, m_num_terms);
+}
+
+// Find the terms of the chain rooted at given node, in left to right
+// order, and if the chain should be rebalanced, append them to
+// m_terms (they are also left in m_work).  Returns true if the chain
+// should be rebalanced.
+bool ChainRebalancer::collect_terms(const FlatAst &in, unsigned root) {
+  AstOp op = in.get_op(root);
+  m_work.clear();
+  m_chain.clear();
+  m_chain.push_back(root);
+
+  while (!m_chain.empty()) {
+    unsigned node = m_chain.back();
+    m_chain.pop_back();
+    if (in.get_op(node) == op) {
+      m_chain.push_back(in.get_right(node));
+      m_chain.push_back(node + 1);
+    } else {
+      m_work.push_back(node);
+    }
+  }
+
+  if (m_work.size() < MIN_TERMS) {
+    return false;
+  }
+
+  m_terms.insert(m_terms.end(), m_work.begin(), m_work.end());
+  m_num_chains++;
+  m_num_terms += m_work.size();
+  return true;
+}
@@ -0,0 +1,60 @@
+#ifndef REBALANCE_H
+#define REBALANCE_H
+
+#include <cstdio>
+#include <vector>
+#include "location.h"
+#include "ast.h"
+
+// Optimization pass which rebalances chains of additions or of
+// multiplications.  A generated expression such as + a + b + c + ...
+// is a maximally deep tree, which can only be evaluated one operation
+// after another.  Since + and * are associative (even when they wrap
+// around on overflow), the terms of a chain can be combined as a
+// balanced tree instead, which has the same value and can be evaluated
+// in parallel (see Interpreter::set_fork_join).
+//
+// The terms are kept in their original order, so they are still
+// evaluated left to right: any assignments in the terms happen in the
+// same order, and any error is the same one raised by the original
+// expression.
+class ChainRebalancer {
+private:
+  // Work item for copying a statement: either an input node, or a
+  // balanced tree combining m_terms[lo..hi-1]
+  struct Item {
+    unsigned node;      // input node, or chain whose terms are combined
+    unsigned lo, hi;    // range of terms (lo == hi for an input node)
+    unsigned parent;    // output node whose right operand this is, or FlatAst::NO_NODE
+  };
+
+  std::vector<unsigned> m_terms;
+  std::vector<unsigned> m_work;
+  std::vector<unsigned> m_chain;
+  std::vector<Item> m_stack;
+
+  unsigned long m_num_chains, m_num_terms;
+
+  // no value semantics
+  ChainRebalancer(const ChainRebalancer &);
+  ChainRebalancer &operator=(const ChainRebalancer &);
+
+public:
+  ChainRebalancer();
+  ~ChainRebalancer();
+
+  // Rebalance all of the statements in an AST, appending them to out
+  void rebalance(const FlatAst &in, FlatAst &out);
+
+  // Rebalance a single statement, appending it to out.  Returns the
+  // index of the statement in out.
+  unsigned rebalance_statement(const FlatAst &in, unsigned stmt, FlatAst &out);
+
+  // Print statistics for all statements rebalanced so far
+  void print_stats(FILE *out) const;
+
+private:
+  bool collect_terms(const FlatAst &in, unsigned root);
+};
+
+#endif // REBALANCE_H
@@ -0,0 +1,183 @@
+#include "scan.h"
+
+#if defined(__x86_64__)
+#  define SCAN_X86 1
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+////////////////////////////////////////////////////////////////////////
+// Scalar implementation
+////////////////////////////////////////////////////////////////////////
+
+// Table of class membership bits, indexed by byte value
+struct ClassTable {
+  unsigned char bits[256];
+
+  ClassTable() {
+    for (int c = 0; c < 256; c++) {
+      unsigned char b = 0;
+      if (c == ' ' || (c >= '\t' && c <= '\r'))
+        b |= 1 << scan::CLASS_SPACE;
+      if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        b |= 1 << scan::CLASS_ALPHA;
+      if (c >= '0' && c <= '9')
+        b |= 1 << scan::CLASS_DIGIT;
+      if (c == '\n')
+        b |= 1 << scan::CLASS_NEWLINE;
+      bits[c] = b;
+    }
+  }
+};
+
+const ClassTable s_table;
+
+void classify_scalar(const char *p, scan::BlockBits &out) {
+  for (unsigned cls = 0; cls < scan::NUM_CLASSES; cls++) {
+    out.bits[cls] = 0;
+  }
+  for (unsigned i = 0; i < scan::BLOCK_SIZE; i++) {
+    unsigned b = s_table.bits[(unsigned char) p[i]];
+    for (unsigned cls = 0; cls < scan::NUM_CLASSES; cls++) {
+      out.bits[cls] |= uint64_t((b >> cls) & 1) << i;
+    }
+  }
+}
+
+#ifdef SCAN_X86
+
+////////////////////////////////////////////////////////////////////////
+// SSE2 implementation
+////////////////////////////////////////////////////////////////////////
+
+// Range checks are done with unsigned byte arithmetic:
+// lo <= c <= hi iff min(c - lo, hi - lo) == c - lo.
+
+inline __m128i in_range_sse2(__m128i v, char lo, char hi) {
+  __m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(char(hi - lo))), d);
+}
+
+void classify_sse2(const char *p, scan::BlockBits &out) {
+  uint64_t space = 0, alpha = 0, digit = 0, newline = 0;
+
+  for (unsigned i = 0; i < scan::BLOCK_SIZE; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    __m128i sp = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+    __m128i al = in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+    __m128i dg = in_range_sse2(v, '0', '9');
+
+    space |= uint64_t(unsigned(_mm_movemask_epi8(sp))) << i;
+    alpha |= uint64_t(unsigned(_mm_movemask_epi8(al))) << i;
+    digit |= uint64_t(unsigned(_mm_movemask_epi8(dg))) << i;
+    newline |= uint64_t(unsigned(_mm_movemask_epi8(nl))) << i;
+  }
+
+  out.bits[scan::CLASS_SPACE] = space;
+  out.bits[scan::CLASS_ALPHA] = alpha;
+  out.bits[scan::CLASS_DIGIT] = digit;
+  out.bits[scan::CLASS_NEWLINE] = newline;
+}
+
+////////////////////////////////////////////////////////////////////////
+// AVX2 implementation
+////////////////////////////////////////////////////////////////////////
+
+#define SCAN_AVX2 __attribute__ ((target ("avx2")))
+
+SCAN_AVX2 inline __m256i in_range_avx2(__m256i v, char lo, char hi) {
+  __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(char(hi - lo))), d);
+}
+
+SCAN_AVX2 void classify_avx2(const char *p, scan::BlockBits &out) {
+  uint64_t space = 0, alpha = 0, digit = 0, newline = 0;
+
+  for (unsigned i = 0; i < scan::BLOCK_SIZE; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+    __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    __m256i sp = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+    __m256i al = in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+    __m256i dg = in_range_avx2(v, '0', '9');
+
+    space |= uint64_t(uint32_t(_mm256_movemask_epi8(sp))) << i;
+    alpha |= uint64_t(uint32_t(_mm256_movemask_epi8(al))) << i;
+    digit |= uint64_t(uint32_t(_mm256_movemask_epi8(dg))) << i;
+    newline |= uint64_t(uint32_t(_mm256_movemask_epi8(nl))) << i;
+  }
+
+  out.bits[scan::CLASS_SPACE] = space;
+  out.bits[scan::CLASS_ALPHA] = alpha;
+  out.bits[scan::CLASS_DIGIT] = digit;
+  out.bits[scan::CLASS_NEWLINE] = newline;
+}
+
+#endif // SCAN_X86
+
+////////////////////////////////////////////////////////////////////////
+// Runtime dispatch
+////////////////////////////////////////////////////////////////////////
+
+struct ScanImpl {
+  const char *name;
+  void (*classify)(const char *p, scan::BlockBits &out);
+};
+
+const ScanImpl s_scalar = { "scalar", classify_scalar };
+#ifdef SCAN_X86
+const ScanImpl s_sse2 = { "sse2", classify_sse2 };
+const ScanImpl s_avx2 = { "avx2", classify_avx2 };
+#endif
+
+const ScanImpl *find_impl(scan::Impl impl) {
+#ifdef SCAN_X86
+  // may be called from a static initializer, so make sure
+  // the CPU feature information is available
+  __builtin_cpu_init();
+#endif
+
+  switch (impl) {
+  case scan::IMPL_SCALAR:
+    return &s_scalar;
+#ifdef SCAN_X86
+  case scan::IMPL_SSE2:
+    return __builtin_cpu_supports("sse2") ? &s_sse2 : nullptr;
+  case scan::IMPL_AVX2:
+    return __builtin_cpu_supports("avx2") ? &s_avx2 : nullptr;
+  case scan::IMPL_AUTO:
+    if (__builtin_cpu_supports("avx2"))
+      return &s_avx2;
+    if (__builtin_cpu_supports("sse2"))
+      return &s_sse2;
+    return &s_scalar;
+#else
+  case scan::IMPL_AUTO:
+    return &s_scalar;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const ScanImpl *s_impl = find_impl(scan::IMPL_AUTO);
+
+} // end anonymous namespace
+
+void scan::classify(const char *p, BlockBits &out) {
+  s_impl->classify(p, out);
+}
+
+bool scan::select_impl(Impl impl) {
+  const ScanImpl *found = find_impl(impl);
+  if (found == nullptr) {
+    return false;
+  }
+  s_impl = found;
+  return true;
+}
+
+const char *scan::get_impl_name() {
+  return s_impl->name;
+}
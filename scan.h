@@ -0,0 +1,53 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstdint>
+
+// Character classification for the lexer.  Rather than testing input
+// characters one at a time, the lexer classifies a 64 byte block of
+// input at a time, producing a bitmap for each character class with
+// one bit per byte.  The end of a run of whitespace, letters, or digits
+// can then be found with a count-trailing-zeroes operation on the
+// bitmap.  SSE2 and AVX2 implementations of the classification are
+// selected at runtime if the CPU supports them, with a portable
+// scalar implementation as a fallback.
+
+namespace scan {
+
+enum CharClass {
+  CLASS_SPACE,     // same characters as isspace in the "C" locale
+  CLASS_ALPHA,     // same characters as isalpha in the "C" locale
+  CLASS_DIGIT,     // same characters as isdigit
+  CLASS_NEWLINE,   // '\n' only
+  NUM_CLASSES,
+};
+
+enum Impl {
+  IMPL_AUTO,       // best implementation supported by this CPU
+  IMPL_SCALAR,
+  IMPL_SSE2,
+  IMPL_AVX2,
+};
+
+const unsigned BLOCK_SIZE = 64;
+
+// Bitmaps classifying one block of input: bit i of bits[cls] is set
+// if byte i of the block is a member of character class cls.
+struct BlockBits {
+  uint64_t bits[NUM_CLASSES];
+};
+
+// Classify the BLOCK_SIZE bytes starting at p.
+void classify(const char *p, BlockBits &out);
+
+// Select the implementation used by classify.  Returns false (and
+// leaves the current implementation in place) if the requested
+// implementation isn't supported.
+bool select_impl(Impl impl);
+
+// Get the name of the implementation currently in use.
+const char *get_impl_name();
+
+}
+
+#endif // SCAN_H
@@ -0,0 +1,129 @@
+// Throughput benchmark for the lexer's character scanning.
+// Generates a random program in memory, then lexes it with each
+// supported scan implementation and reports the throughput.
+//
+// Usage: scanbench [megabytes]
+//
+// The default input size is 16 MB.  "make bench" builds the benchmark
+// with -O2 (the rest of the build uses the default -g).
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include "scan.h"
+#include "input.h"
+#include "lexer.h"
+#include "exceptions.h"
+
+namespace {
+
+// Generate a random (syntactically valid) program of at least
+// given size, with a mix of identifiers, literals, and operators
+std::string gen_program(size_t size) {
+  static const char *names[] = { "x", "y", "total", "count", "alpha", "beta", "idx", "sum" };
+  static const char *ops[] = { "+", "-", "*", "/" };
+  const int NUM_NAMES = int(sizeof(names) / sizeof(names[0]));
+
+  std::string text;
+  unsigned seed = 12345;
+  auto rnd = [&seed](unsigned n) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) % n;
+  };
+
+  while (text.size() < size) {
+    text += "= ";
+    text += names[rnd(NUM_NAMES)];
+    int nops = int(rnd(6));
+    for (int i = 0; i < nops; i++) {
+      text += ' ';
+      text += ops[rnd(4)];
+    }
+    for (int i = 0; i <= nops; i++) {
+      text += ' ';
+      if (rnd(2)) {
+        text += names[rnd(NUM_NAMES)];
+      } else {
+        text += std::to_string(rnd(1000000));
+      }
+    }
+    text += ";\n";
+  }
+
+  return text;
+}
+
+// Time classifying every block of the input, i.e., just the
+// vectorizable part of lexing
+double time_classify(const std::string &text) {
+  auto start = std::chrono::steady_clock::now();
+  scan::BlockBits bits;
+  uint64_t check = 0;
+  size_t nblocks = text.size() / scan::BLOCK_SIZE;
+  for (size_t i = 0; i < nblocks; i++) {
+    scan::classify(text.data() + i * scan::BLOCK_SIZE, bits);
+    check += bits.bits[scan::CLASS_SPACE];
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  // make sure the classification isn't optimized away
+  if (check == 42) {
+    printf("!\n");
+  }
+  return elapsed.count();
+}
+
+// Time lexing the entire input
+double time_lex(const std::string &text, unsigned long &ntokens) {
+  SymbolTable symtab;
+  Lexer lexer(new MemoryInputSource(text.data(), text.size()), "<bench>", &symtab);
+  auto start = std::chrono::steady_clock::now();
+  ntokens = 0;
+  while (lexer.peek().kind != TOK_EOF) {
+    lexer.next();
+    ntokens++;
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void bench(scan::Impl impl, const std::string &text) {
+  if (!scan::select_impl(impl)) {
+    return;
+  }
+
+  const int NUM_RUNS = 5;
+  double best_classify = 1e9, best_lex = 1e9;
+  unsigned long ntokens = 0;
+
+  for (int run = 0; run < NUM_RUNS; run++) {
+    best_classify = std::min(best_classify, time_classify(text));
+    best_lex = std::min(best_lex, time_lex(text, ntokens));
+  }
+
+  double gb = double(text.size()) / 1e9;
+  printf("%-8s classify %7.3f GB/s   lex %7.3f GB/s (%lu tokens, %.1f Mtokens/s)\n",
+         scan::get_impl_name(), gb / best_classify, gb / best_lex,
+         ntokens, double(ntokens) / best_lex / 1e6);
+}
+
+}
+
+int main(int argc, char **argv) {
+  size_t megabytes = (argc > 1) ? size_t(atol(argv[1])) : 16;
+
+  try {
+    std::string text = gen_program(megabytes << 20);
+    printf("Input: %lu bytes\n", (unsigned long) text.size());
+
+    bench(scan::IMPL_SCALAR, text);
+    bench(scan::IMPL_SSE2, text);
+    bench(scan::IMPL_AVX2, text);
+  } catch (BaseException &ex) {
+    fprintf(stderr, "Error: %s\n", ex.what());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,468 @@
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <csignal>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "cpputil.h"
+#include "exceptions.h"
+#include "srcmgr.h"
+#include "input.h"
+#include "lexer.h"
+#include "parser.h"
+#include "ast.h"
+#include "interp.h"
+#include "server.h"
+
+namespace {
+
+// requests longer than this are refused, and the connection is closed
+const size_t MAX_REQUEST = size_t(1) << 28;
+
+// a client which doesn't accept a response within this many
+// milliseconds is disconnected
+const int SEND_TIMEOUT = 10000;
+
+// write end of the server's wakeup pipe, for the signal handler
+int s_signal_fd = -1;
+volatile sig_atomic_t s_interrupted = 0;
+
+void on_signal(int) {
+  s_interrupted = 1;
+  if (s_signal_fd >= 0) {
+    ssize_t rc = write(s_signal_fd, "!", 1);
+    (void) rc;
+  }
+}
+
+// Send data on a non-blocking socket, waiting (up to SEND_TIMEOUT)
+// when the socket's buffer is full
+bool send_all(int fd, const std::string &data) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    ssize_t n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = { fd, POLLOUT, 0 };
+      int rc = poll(&pfd, 1, SEND_TIMEOUT);
+      if (rc < 0 && errno == EINTR) {
+        continue;
+      }
+      if (rc <= 0) {
+        return false;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    pos += size_t(n);
+  }
+  return true;
+}
+
+// Parse the program length of an EVAL request, which must be a
+// decimal number (with no sign).  Returns false if it isn't valid.
+bool parse_length(const std::string &s, size_t &len) {
+  if (s.empty() || s.size() > 18 || s.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  len = size_t(strtoull(s.c_str(), nullptr, 10));
+  return true;
+}
+
+// Find the extent of the first request in the data received from a
+// connection: the length of its request line, and its total length
+// (including the program text of an EVAL request).  Returns 1 if the
+// whole request has been received, 0 if not, and -1 if the request is
+// too long.  An EVAL request whose length isn't valid is taken to have
+// no program text (handle rejects it).
+int find_request(const std::string &buf, size_t &line_len, size_t &total) {
+  size_t nl = buf.find('\n');
+  if (nl == std::string::npos) {
+    return buf.size() > MAX_REQUEST ? -1 : 0;
+  }
+
+  // an EVAL request is followed by the program text
+  size_t len = 0;
+  if (buf.compare(0, 5, "EVAL ") == 0) {
+    size_t end = buf.find_first_of(" \r\n", 5);
+    if (!parse_length(buf.substr(5, end - 5), len)) {
+      len = 0;
+    } else if (len > MAX_REQUEST) {
+      return -1;
+    }
+  }
+  line_len = nl;
+  total = nl + 1 + len;
+  return buf.size() >= total ? 1 : 0;
+}
+
+// Split a request line into words separated by spaces
+std::vector<std::string> split(const std::string &line) {
+  std::vector<std::string> words;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    size_t end = line.find(' ', pos);
+    if (end == std::string::npos) {
+      end = line.size();
+    }
+    if (end > pos) {
+      words.push_back(line.substr(pos, end - pos));
+    }
+    pos = end + 1;
+  }
+  return words;
+}
+
+bool parse_long(const std::string &s, long &value) {
+  char *end;
+  errno = 0;
+  value = strtol(s.c_str(), &end, 10);
+  return !s.empty() && *end == '\0' && errno == 0;
+}
+
+// Variable names are the same as identifiers in programs
+bool is_name(const std::string &s) {
+  if (s.empty()) {
+    return false;
+  }
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    if (!((*i >= 'a' && *i <= 'z') || (*i >= 'A' && *i <= 'Z'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string error_response(const BaseException &ex) {
+  if (ex.has_location()) {
+    const Location &loc = ex.get_loc();
+    return cpputil::format("ERROR %s:%d: %s\n", loc.get_srcfile().c_str(), loc.get_line(), ex.what());
+  }
+  return cpputil::format("ERROR %s\n", ex.what());
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// Server implementation
+////////////////////////////////////////////////////////////////////////
+
+Server::Server(const char *path, unsigned num_threads)
+  : m_path(path)
+  , m_num_threads(num_threads)
+  , m_listen_fd(-1)
+  , m_done(false) {
+  if (m_num_threads == 0) {
+    m_num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  struct sockaddr_un addr;
+  if (m_path.size() >= sizeof(addr.sun_path)) {
+    RuntimeError::raise("Socket path '%s' is too long", path);
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  if (pipe(m_wakeup) != 0) {
+    RuntimeError::raise("Could not create pipe: %s", strerror(errno));
+  }
+
+  // a socket left behind by a previous server is replaced
+  unlink(path);
+  m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (m_listen_fd < 0
+      || ::bind(m_listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0
+      || listen(m_listen_fd, 128) != 0) {
+    std::string err = strerror(errno);
+    if (m_listen_fd >= 0) {
+      close(m_listen_fd);
+    }
+    close(m_wakeup[0]);
+    close(m_wakeup[1]);
+    RuntimeError::raise("Could not listen on '%s': %s", path, err.c_str());
+  }
+}
+
+Server::~Server() {
+  close(m_listen_fd);
+  close(m_wakeup[0]);
+  close(m_wakeup[1]);
+  unlink(m_path.c_str());
+}
+
+void Server::run() {
+  // Only the main thread handles SIGINT and SIGTERM, which wake it up
+  // through the pipe
+  sigset_t sigs, old_sigs;
+  sigemptyset(&sigs);
+  sigaddset(&sigs, SIGINT);
+  sigaddset(&sigs, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &sigs, &old_sigs);
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < m_num_threads; i++) {
+    threads.emplace_back(&Server::worker, this);
+  }
+
+  s_signal_fd = m_wakeup[1];
+  s_interrupted = 0;
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  pthread_sigmask(SIG_SETMASK, &old_sigs, nullptr);
+
+  // connections waiting for a request
+  std::vector<Connection *> idle;
+  std::vector<struct pollfd> fds;
+
+  while (!s_interrupted) {
+    fds.clear();
+    fds.push_back({ m_listen_fd, POLLIN, 0 });
+    fds.push_back({ m_wakeup[0], POLLIN, 0 });
+    for (auto i = idle.begin(); i != idle.end(); ++i) {
+      fds.push_back({ (*i)->fd, POLLIN, 0 });
+    }
+
+    if (poll(fds.data(), fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      RuntimeError::raise("poll failed: %s", strerror(errno));
+    }
+
+    // read what has arrived, and hand the connections with a complete
+    // request to the workers
+    std::vector<Connection *> still_idle, ready;
+    for (unsigned i = 0; i < idle.size(); i++) {
+      Connection *conn = idle[i];
+      if (fds[i + 2].revents == 0) {
+        still_idle.push_back(conn);
+      } else if (receive(conn)) {
+        ready.push_back(conn);
+      } else if (conn->closed) {
+        close(conn->fd);
+        delete conn;
+      } else {
+        still_idle.push_back(conn);
+      }
+    }
+    idle.swap(still_idle);
+    if (!ready.empty()) {
+      std::lock_guard<std::mutex> guard(m_lock);
+      m_ready.insert(m_ready.end(), ready.begin(), ready.end());
+      m_ready_cond.notify_all();
+    }
+
+    if (fds[1].revents != 0) {
+      char buf[64];
+      ssize_t rc = read(m_wakeup[0], buf, sizeof(buf));
+      (void) rc;
+      std::lock_guard<std::mutex> guard(m_lock);
+      idle.insert(idle.end(), m_returned.begin(), m_returned.end());
+      m_returned.clear();
+    }
+
+    if (fds[0].revents != 0) {
+      int fd = accept(m_listen_fd, nullptr, nullptr);
+      if (fd >= 0) {
+        // the main thread must never block reading from a connection
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        idle.push_back(new Connection(fd));
+      }
+    }
+  }
+
+  // stop the workers, and close the connections
+  {
+    std::lock_guard<std::mutex> guard(m_lock);
+    m_done = true;
+    m_ready_cond.notify_all();
+  }
+  for (auto i = threads.begin(); i != threads.end(); ++i) {
+    i->join();
+  }
+  idle.insert(idle.end(), m_ready.begin(), m_ready.end());
+  idle.insert(idle.end(), m_returned.begin(), m_returned.end());
+  for (auto i = idle.begin(); i != idle.end(); ++i) {
+    close((*i)->fd);
+    delete *i;
+  }
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  s_signal_fd = -1;
+}
+
+void Server::worker() {
+  for (;;) {
+    Connection *conn;
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      while (!m_done && m_ready.empty()) {
+        m_ready_cond.wait(guard);
+      }
+      if (m_done) {
+        return;
+      }
+      conn = m_ready.front();
+      m_ready.pop_front();
+    }
+
+    if (serve(conn)) {
+      // wait for the next request
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_returned.push_back(conn);
+      }
+      ssize_t rc = write(m_wakeup[1], "", 1);
+      (void) rc;
+    } else {
+      close(conn->fd);
+      delete conn;
+    }
+  }
+}
+
+// Read the data available on a connection (without blocking), after
+// poll has reported it is readable.  Returns true if the connection
+// should be handed to a worker: it has a complete request, or it has
+// a request which is too long (which the worker refuses).  Sets the
+// connection's closed flag if the client has closed its end.
+bool Server::receive(Connection *conn) {
+  char buf[65536];
+  ssize_t n;
+  do {
+    n = recv(conn->fd, buf, sizeof(buf), 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n > 0) {
+    conn->buf.append(buf, size_t(n));
+  } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+    conn->closed = true;
+  }
+
+  size_t line_len, total;
+  return find_request(conn->buf, line_len, total) != 0;
+}
+
+// Serve a connection which has a complete request: handle requests
+// until there are no more complete requests in the data received.
+// Returns false if the connection should be closed.
+bool Server::serve(Connection *conn) {
+  std::string line, text;
+  for (;;) {
+    int rc = read_request(conn, line, text);
+    if (rc < 0) {
+      return false;
+    }
+    if (rc == 0) {
+      return !conn->closed;
+    }
+    if (!send_all(conn->fd, handle(conn, line, text))) {
+      return false;
+    }
+  }
+}
+
+// Get the next request from the data received from the connection.
+// Returns 1 if there is a request, 0 if a complete request hasn't been
+// received, and -1 if the request is too long.
+int Server::read_request(Connection *conn, std::string &line, std::string &text) {
+  size_t line_len, total;
+  int rc = find_request(conn->buf, line_len, total);
+  if (rc <= 0) {
+    return rc;
+  }
+
+  line.assign(conn->buf, 0, line_len);
+  if (!line.empty() && line.back() == '\r') {
+    line.pop_back();
+  }
+  text.assign(conn->buf, line_len + 1, total - line_len - 1);
+  conn->buf.erase(0, total);
+  return 1;
+}
+
+std::string Server::handle(Connection *conn, const std::string &line, const std::string &text) {
+  std::vector<std::string> words = split(line);
+  if (words.empty()) {
+    return "ERROR Empty request\n";
+  }
+  const std::string &cmd = words[0];
+
+  if (cmd == "EVAL" && words.size() >= 2) {
+    size_t len;
+    if (!parse_length(words[1], len) || len != text.size()) {
+      return "ERROR Invalid length\n";
+    }
+    for (unsigned i = 2; i < words.size(); i++) {
+      size_t eq = words[i].find('=');
+      long value;
+      if (eq == std::string::npos || !is_name(words[i].substr(0, eq))
+          || !parse_long(words[i].substr(eq + 1), value)) {
+        return "ERROR Invalid binding '" + words[i] + "'\n";
+      }
+      bind(conn, words[i].substr(0, eq), value);
+    }
+    return eval(conn, text);
+  } else if (cmd == "SET" && words.size() == 3) {
+    long value;
+    if (!is_name(words[1]) || !parse_long(words[2], value)) {
+      return "ERROR Invalid binding '" + words[1] + " " + words[2] + "'\n";
+    }
+    bind(conn, words[1], value);
+    return "OK\n";
+  } else if (cmd == "GET" && words.size() == 2) {
+    long value;
+    if (!conn->env.get_var(words[1], value)) {
+      return "ERROR Undefined variable '" + words[1] + "'\n";
+    }
+    return cpputil::format("VALUE %ld\n", value);
+  } else if (cmd == "RESET" && words.size() == 1) {
+    conn->env.resolve_slots();
+    memset(conn->env.get_defined(), 0, conn->env.get_num_slots());
+    return "OK\n";
+  }
+
+  return "ERROR Invalid request '" + cmd + "'\n";
+}
+
+std::string Server::eval(Connection *conn, const std::string &text) {
+  NodeArena arena;
+  Lexer *lexer = new Lexer(new MemoryInputSource(text.data(), text.size()), "<request>", &conn->symtab);
+  unsigned src = lexer->get_src_id();
+  std::string response;
+
+  try {
+    Parser parser(lexer, &arena);
+    FlatAst ast;
+    ast.add_unit(parser.parse());
+    arena.clear();
+
+    Interpreter interp(&ast, &conn->env);
+    response = cpputil::format("RESULT %ld\n", interp.exec());
+  } catch (BaseException &ex) {
+    response = error_response(ex);
+  }
+
+  // the error message has the line number, so the source isn't needed
+  SourceManager::get_instance().remove_source(src);
+  return response;
+}
+
+void Server::bind(Connection *conn, const std::string &name, long value) {
+  unsigned slot = conn->symtab.intern(name);
+  conn->env.resolve_slots();
+  conn->env.get_values()[slot] = value;
+  conn->env.get_defined()[slot] = 1;
+}
@@ -0,0 +1,80 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include "symtab.h"
+#include "env.h"
+
+// A daemon which evaluates programs sent by clients over a Unix domain
+// socket, so that small evaluations don't pay for starting a process.
+// Each connection has its own variables, which persist from one request
+// to the next.  Requests are evaluated by a pool of worker threads: the
+// main thread reads from the connections (without blocking), and hands
+// a connection to the workers once a complete request has been received,
+// so a connection is only ever served by one worker at a time, its
+// requests are evaluated in order, and a client which sends part of a
+// request can't hold up a worker.
+//
+// Requests and responses are lines of text.  A request to evaluate a
+// program gives the length in bytes of the program text (a decimal
+// number), which follows the request line.  If the length isn't a
+// valid number, no program text is read, and the response is
+// ERROR Invalid length.
+//
+//   EVAL len [name=value...]   evaluate program (after binding variables)
+//                              -> RESULT value
+//   SET name value             -> OK
+//   GET name                   -> VALUE value
+//   RESET                      forget all variables -> OK
+//
+// A request which fails gets the response ERROR message.
+class Server {
+private:
+  struct Connection {
+    int fd;
+    std::string buf;        // data received but not yet processed
+    bool closed;            // client has closed its end
+    SymbolTable symtab;
+    Environment env;
+
+    Connection(int fd_) : fd(fd_), closed(false), env(&symtab) { }
+  };
+
+  std::string m_path;
+  unsigned m_num_threads;
+  int m_listen_fd;
+  int m_wakeup[2];                        // pipe for waking the main thread
+
+  std::mutex m_lock;
+  std::condition_variable m_ready_cond;
+  std::deque<Connection *> m_ready;       // connections with a request
+  std::vector<Connection *> m_returned;   // served, waiting for more requests
+  bool m_done;
+
+  // no value semantics
+  Server(const Server &);
+  Server &operator=(const Server &);
+
+public:
+  // A num_threads value of 0 means to use one thread per CPU
+  Server(const char *path, unsigned num_threads);
+  ~Server();
+
+  // Serve requests until interrupted (SIGINT or SIGTERM)
+  void run();
+
+private:
+  void worker();
+  bool receive(Connection *conn);
+  bool serve(Connection *conn);
+  int read_request(Connection *conn, std::string &line, std::string &text);
+  std::string handle(Connection *conn, const std::string &line, const std::string &text);
+  std::string eval(Connection *conn, const std::string &text);
+  void bind(Connection *conn, const std::string &name, long value);
+};
+
+#endif // SERVER_H
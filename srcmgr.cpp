@@ -0,0 +1,101 @@
+#include <algorithm>
+#include "srcmgr.h"
+
+////////////////////////////////////////////////////////////////////////
+// SourceManager implementation
+////////////////////////////////////////////////////////////////////////
+
+SourceManager::SourceManager() {
+}
+
+SourceManager::~SourceManager() {
+}
+
+SourceManager &SourceManager::get_instance() {
+  static SourceManager s_instance;
+  return s_instance;
+}
+
+unsigned SourceManager::add_source(const std::string &filename) {
+  std::lock_guard<std::mutex> guard(m_lock);
+
+  // intern the filename
+  std::map<std::string, const std::string *>::const_iterator i = m_filename_map.find(filename);
+  const std::string *interned;
+  if (i != m_filename_map.end()) {
+    interned = i->second;
+  } else {
+    m_filenames.push_back(filename);
+    interned = &m_filenames.back();
+    m_filename_map[filename] = interned;
+  }
+
+  Source source;
+  source.filename = interned;
+  source.line_starts.push_back(0); // first line starts at offset 0
+  source.first_line = 1;
+  if (!m_free.empty()) {
+    unsigned src = m_free.back();
+    m_free.pop_back();
+    m_sources[src] = source;
+    return src;
+  }
+  m_sources.push_back(source);
+
+  return unsigned(m_sources.size() - 1);
+}
+
+void SourceManager::add_line_starts(unsigned src, const std::vector<unsigned long> &offsets) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  std::vector<unsigned long> &line_starts = m_sources.at(src).line_starts;
+  line_starts.insert(line_starts.end(), offsets.begin(), offsets.end());
+}
+
+void SourceManager::discard_line_starts(unsigned src, unsigned long offset) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  int index = find_line_index(src, offset);
+  if (index > 0) {
+    Source &source = m_sources.at(src);
+    source.line_starts.erase(source.line_starts.begin(), source.line_starts.begin() + index);
+    source.first_line += index;
+  }
+}
+
+void SourceManager::remove_source(unsigned src) {
+  std::lock_guard<std::mutex> guard(m_lock);
+  std::vector<unsigned long>().swap(m_sources.at(src).line_starts);
+  m_free.push_back(src);
+}
+
+const std::string &SourceManager::get_filename(unsigned src) const {
+  std::lock_guard<std::mutex> guard(m_lock);
+  return *m_sources.at(src).filename;
+}
+
+int SourceManager::get_line(unsigned src, unsigned long offset) const {
+  std::lock_guard<std::mutex> guard(m_lock);
+  int index = find_line_index(src, offset);
+  if (index < 0) {
+    return -1;
+  }
+  return m_sources.at(src).first_line + index;
+}
+
+int SourceManager::get_col(unsigned src, unsigned long offset) const {
+  std::lock_guard<std::mutex> guard(m_lock);
+  int index = find_line_index(src, offset);
+  if (index < 0) {
+    return -1;
+  }
+  return int(offset - m_sources.at(src).line_starts[unsigned(index)]) + 1;
+}
+
+// Find the index of the line containing given offset, i.e., the
+// last line starting at or before it.  Returns -1 if the offset
+// precedes all of the line start offsets that have been retained.
+int SourceManager::find_line_index(unsigned src, unsigned long offset) const {
+  const std::vector<unsigned long> &line_starts = m_sources.at(src).line_starts;
+  std::vector<unsigned long>::const_iterator i =
+    std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+  return int(i - line_starts.begin()) - 1;
+}
@@ -0,0 +1,78 @@
+#ifndef SRCMGR_H
+#define SRCMGR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+
+// The SourceManager keeps track of all of the sources of input
+// (files, stdin) being processed.  Each source is identified by
+// a small integer id, so a Location only needs to store a source id
+// and a byte offset.  Filenames are interned, so each distinct
+// filename is stored only once.  The lexer records the offset of
+// the start of each line, which allows line and column numbers to
+// be computed from a byte offset when they are needed
+// (e.g., for an error message).  All of the member functions may be
+// called concurrently from different threads.
+class SourceManager {
+private:
+  struct Source {
+    const std::string *filename;
+    std::vector<unsigned long> line_starts;  // offset of start of each line
+    int first_line;                          // line number of line_starts[0]
+  };
+
+  std::deque<std::string> m_filenames;
+  std::map<std::string, const std::string *> m_filename_map;
+  std::vector<Source> m_sources;
+  std::vector<unsigned> m_free;      // ids of removed sources, for reuse
+  mutable std::mutex m_lock;
+
+  // no value semantics
+  SourceManager(const SourceManager &);
+  SourceManager &operator=(const SourceManager &);
+
+  SourceManager();
+
+public:
+  ~SourceManager();
+
+  // Get the global SourceManager instance
+  static SourceManager &get_instance();
+
+  // Add a new source with given filename, returning its id.
+  unsigned add_source(const std::string &filename);
+
+  // Record the starts of lines of given source (the lexer collects
+  // them, so that the SourceManager is only locked once per batch).
+  // The offsets must be in increasing order, and follow any line
+  // starts already recorded.
+  void add_line_starts(unsigned src, const std::vector<unsigned long> &offsets);
+
+  // Discard the line start offsets of all lines preceding the line
+  // containing given offset.  This keeps memory use bounded when
+  // processing an input of unlimited size, but means that line and
+  // column numbers can no longer be computed for earlier offsets.
+  void discard_line_starts(unsigned src, unsigned long offset);
+
+  // Remove a source which is no longer needed, so that a long-running
+  // process which reads many sources doesn't accumulate their line
+  // information.  Its id may be reused by a later source, so Locations
+  // in the removed source must no longer be used.
+  void remove_source(unsigned src);
+
+  const std::string &get_filename(unsigned src) const;
+
+  // Compute the line and column numbers (both starting at 1) of
+  // given byte offset in given source.  Returns -1 if the line
+  // information for the offset has been discarded.
+  int get_line(unsigned src, unsigned long offset) const;
+  int get_col(unsigned src, unsigned long offset) const;
+
+private:
+  int find_line_index(unsigned src, unsigned long offset) const;
+};
+
+#endif // SRCMGR_H
@@ -0,0 +1,85 @@
+#! /bin/sh
+
+# Stress tests for deeply nested expressions: generates inputs nested
+# 10^6 levels deep and checks that each engine parses, evaluates, and
+# frees them, with a small stack so that any recursion proportional to
+# the nesting depth would overflow it.  Also checks the line numbers
+# reported for errors following blank lines and line breaks within a
+# statement.
+#
+# Usage: stress.sh [depth]
+
+DEPTH=${1:-1000000}
+PFXCALC=${PFXCALC:-./pfxcalc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+failures=0
+
+# run_test name file expected-output [pfxcalc options...]
+run_test() {
+	name=$1
+	file=$2
+	expected=$3
+	shift 3
+	actual=$( (ulimit -s 1024; "$PFXCALC" "$@" "$file") 2>&1 )
+	if [ "$actual" = "$expected" ]; then
+		echo "ok      $name $*"
+	else
+		echo "FAILED  $name $*: expected '$expected', got '$actual'"
+		failures=$((failures + 1))
+	fi
+}
+
+# + + + ... 1 2 3 ... (left-nested)
+awk -v n="$DEPTH" 'BEGIN {
+	for (i = 0; i < n; i++) printf "+ ";
+	for (i = 1; i <= n + 1; i++) printf "%d ", i;
+	print ";";
+}' > "$DIR/left.pfx"
+left_result="Result: $(( (DEPTH + 1) * (DEPTH + 2) / 2 ))"
+
+# + 1 + 1 + 1 ... 1 (right-nested chain)
+awk -v n="$DEPTH" 'BEGIN {
+	for (i = 0; i < n; i++) printf "+ 1 ";
+	print "1;";
+}' > "$DIR/chain.pfx"
+chain_result="Result: $((DEPTH + 1))"
+
+# = a = a = a ... 7 (chained assignments)
+awk -v n="$DEPTH" 'BEGIN {
+	for (i = 0; i < n; i++) printf "= a ";
+	print "7;";
+	print "+ a a;";
+}' > "$DIR/assign.pfx"
+
+# a deep expression missing its last operand
+awk -v n="$DEPTH" 'BEGIN {
+	for (i = 0; i < n; i++) printf "+ ";
+	for (i = 1; i <= n; i++) printf "%d ", i;
+	print ";";
+}' > "$DIR/truncated.pfx"
+truncated_result="$DIR/truncated.pfx:1: Error: Illegal expression (at ';')"
+
+# Error line numbers: the line of the offending token.  (The original
+# lexer counted a newline immediately following a token twice, since
+# putting it back didn't undo the line count.)
+printf '+ 1\n\n 2 3;\n' > "$DIR/line_blank.pfx"
+printf '= x\n;\n' > "$DIR/line_break.pfx"
+printf '= x 1;\n\n/ x\n  - x 1;\n' > "$DIR/line_eval.pfx"
+
+for opts in "" "-b" "-s"; do
+	run_test line_blank "$DIR/line_blank.pfx" "$DIR/line_blank.pfx:3: Error: Unexpected token '3'" $opts
+	run_test line_break "$DIR/line_break.pfx" "$DIR/line_break.pfx:2: Error: Illegal expression (at ';')" $opts
+	run_test line_eval "$DIR/line_eval.pfx" "$DIR/line_eval.pfx:3: Error: Division by zero" $opts
+	run_test left "$DIR/left.pfx" "$left_result" $opts
+	run_test chain "$DIR/chain.pfx" "$chain_result" $opts
+	run_test assign "$DIR/assign.pfx" "Result: 14" $opts
+	run_test truncated "$DIR/truncated.pfx" "$truncated_result" $opts
+done
+
+if [ $failures -ne 0 ]; then
+	echo "$failures test(s) failed"
+	exit 1
+fi
+echo "All tests passed"
@@ -0,0 +1,76 @@
+#include <cstring>
+#include "symtab.h"
+
+namespace {
+
+// FNV-1a hash
+unsigned hash_name(const char *name, unsigned len) {
+  unsigned h = 2166136261u;
+  for (unsigned i = 0; i < len; i++) {
+    h ^= (unsigned char) name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////
+// SymbolTable implementation
+////////////////////////////////////////////////////////////////////////
+
+SymbolTable::SymbolTable()
+  : m_buckets(64, -1) {
+}
+
+SymbolTable::~SymbolTable() {
+}
+
+unsigned SymbolTable::intern(const char *name, unsigned len) {
+  unsigned b = find_bucket(name, len);
+  if (m_buckets[b] >= 0) {
+    return unsigned(m_buckets[b]);
+  }
+
+  unsigned id = unsigned(m_names.size());
+  m_names.push_back(std::string(name, len));
+  m_buckets[b] = int(id);
+
+  // keep the load factor at or below 1/2
+  if (m_names.size() * 2 > m_buckets.size()) {
+    grow();
+  }
+
+  return id;
+}
+
+int SymbolTable::lookup(const std::string &name) const {
+  return m_buckets[find_bucket(name.data(), unsigned(name.size()))];
+}
+
+// Find the bucket containing given name, or the empty bucket
+// where it should be added.
+unsigned SymbolTable::find_bucket(const char *name, unsigned len) const {
+  unsigned mask = unsigned(m_buckets.size()) - 1;
+  unsigned b = hash_name(name, len) & mask;
+  for (;;) {
+    int id = m_buckets[b];
+    if (id < 0) {
+      return b;
+    }
+    const std::string &s = m_names[unsigned(id)];
+    if (s.size() == len && memcmp(s.data(), name, len) == 0) {
+      return b;
+    }
+    b = (b + 1) & mask;
+  }
+}
+
+// Double the number of hash buckets, and rehash all names
+void SymbolTable::grow() {
+  m_buckets.assign(m_buckets.size() * 2, -1);
+  for (unsigned id = 0; id < m_names.size(); id++) {
+    const std::string &s = m_names[id];
+    m_buckets[find_bucket(s.data(), unsigned(s.size()))] = int(id);
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+#include <string>
+#include <vector>
+
+// A SymbolTable interns identifiers, assigning each distinct name a
+// small integer id.  Ids are dense (the first name interned is 0, the
+// next is 1, etc.), so they can be used to index arrays.  Interning
+// an identifier which is already in the table doesn't allocate memory.
+class SymbolTable {
+private:
+  std::vector<std::string> m_names;  // indexed by symbol id
+  std::vector<int> m_buckets;        // open addressing hash table of ids
+
+  // no value semantics
+  SymbolTable(const SymbolTable &);
+  SymbolTable &operator=(const SymbolTable &);
+
+public:
+  SymbolTable();
+  ~SymbolTable();
+
+  // Get the id of given name, adding it to the table if necessary.
+  unsigned intern(const char *name, unsigned len);
+  unsigned intern(const std::string &name) { return intern(name.data(), unsigned(name.size())); }
+
+  // Get the id of given name, or -1 if it isn't in the table.
+  int lookup(const std::string &name) const;
+
+  unsigned get_num_symbols() const { return unsigned(m_names.size()); }
+  const std::string &get_name(unsigned id) const { return m_names.at(id); }
+
+private:
+  unsigned find_bucket(const char *name, unsigned len) const;
+  void grow();
+};
+
+#endif // SYMTAB_H
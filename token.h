@@ -2,7 +2,7 @@
 #define TOKEN_H
 
 // This header file defines the tags used for tokens (i.e., terminal
-// symbols in the grammar.)
+// symbols in the grammar), and the Token type returned by the lexer.
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,6 +17,20 @@ enum TokenKind {
   TOK_DIVIDE,
   TOK_ASSIGN,
   TOK_SEMICOLON,
+  TOK_EOF,          // end of input
+};
+
+// A token read by the lexer.  Tokens are small values, and don't
+// own their lexeme: it points directly into the lexer's input buffer,
+// is not NUL-terminated, and is valid only until the lexer's next
+// or peek function is called again.
+struct Token {
+  enum TokenKind kind;
+  const char *lexeme;
+  unsigned len;
+  unsigned long offset;   // byte offset of the lexeme in the input
+  long value;             // value of an integer literal
+  int sym;                // symbol id of an identifier
 };
 
 #ifdef __cplusplus
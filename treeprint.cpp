@@ -40,6 +40,7 @@ struct TreePrintContext {
 
   void pushctx(int nsibs);
   void popctx();
+  void print_tree(Node *root);
   void print_node(Node *n);
 };
 
@@ -51,6 +52,34 @@ void TreePrintContext::popctx() {
   stack.pop_back();
 }
 
+// Print an entire tree.  Nodes are visited in preorder using an
+// explicit worklist rather than recursion, so that very deep trees
+// can be printed.  Each worklist entry records the depth of the
+// context stack at which the node should be printed: contexts
+// for subtrees which have been completely printed are popped
+// when moving on to the next node.
+void TreePrintContext::print_tree(Node *root) {
+  std::vector<std::pair<Node *, size_t>> worklist;
+  worklist.push_back({ root, stack.size() });
+
+  while (!worklist.empty()) {
+    Node *n = worklist.back().first;
+    size_t depth = worklist.back().second;
+    worklist.pop_back();
+
+    while (stack.size() > depth) {
+      popctx();
+    }
+    print_node(n);
+
+    int nkids = n->get_num_kids();
+    pushctx(nkids);
+    for (int i = nkids - 1; i >= 0; i--) {
+      worklist.push_back({ n->get_kid(i), stack.size() });
+    }
+  }
+}
+
 void TreePrintContext::print_node(Node *n) {
   int depth = int(stack.size());
   assert(depth > 0);
@@ -69,7 +98,7 @@ void TreePrintContext::print_node(Node *n) {
   }
 
   int tag = n->get_tag();
-  std::string str = n->get_str();
+  std::string str = tp_obj->node_str(n);
 
   printf("%s", tp_obj->node_tag_to_string(tag).c_str());
   if (!str.empty()) {
@@ -77,13 +106,6 @@ void TreePrintContext::print_node(Node *n) {
   }
   printf("\n");
   stack[depth-1].first++;
-
-  int nkids = n->get_num_kids();
-  pushctx(nkids);
-  for (int i = 0; i < nkids; i++) {
-    print_node(n->get_kid(i));
-  }
-  popctx();
 }
 
 } // end anonymous namespace
@@ -94,8 +116,12 @@ TreePrint::TreePrint() {
 TreePrint::~TreePrint() {
 }
 
+std::string TreePrint::node_str(Node *n) const {
+  return n->get_str();
+}
+
 void TreePrint::print(Node *t) const {
   TreePrintContext ctx(this);
   ctx.pushctx(1);
-  ctx.print_node(t);
+  ctx.print_tree(t);
 }
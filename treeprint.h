@@ -32,6 +32,10 @@ public:
   void print(Node *t) const;
 
   virtual std::string node_tag_to_string(int tag) const = 0;
+
+  // get the string to print for a node (if any): by default,
+  // the node's string value
+  virtual std::string node_str(Node *n) const;
 };
 
 #endif // TREEPRINT_H
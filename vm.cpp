@@ -0,0 +1,114 @@
+#include "exceptions.h"
+#include "arith.h"
+#include "vm.h"
+
+// With GCC and Clang, the dispatch loop is threaded: each instruction
+// handler jumps directly to the handler for the next instruction
+// through a table of label addresses, rather than returning to a
+// single switch.  Otherwise, a switch in a loop is used.
+#if defined(__GNUC__)
+#  define VM_THREADED 1
+#endif
+
+#ifdef VM_THREADED
+#  define VM_DISPATCH()   goto *s_handlers[pc->op]
+#  define VM_BEGIN        VM_DISPATCH();
+#  define VM_CASE(op)     L_##op:
+#  define VM_NEXT()       do { ++pc; VM_DISPATCH(); } while (0)
+#  define VM_END
+#else
+#  define VM_BEGIN        for (;;) { switch (pc->op) {
+#  define VM_CASE(op)     case op:
+#  define VM_NEXT()       do { ++pc; continue; } while (0)
+#  define VM_END          default: RuntimeError::raise("Unknown opcode: %d", int(pc->op)); } }
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Vm implementation
+////////////////////////////////////////////////////////////////////////
+
+Vm::Vm(Environment *env)
+  : m_env(env) {
+}
+
+Vm::~Vm() {
+}
+
+long Vm::run(const Bytecode &code) {
+#ifdef VM_THREADED
+  // must be in the same order as the Opcode enumeration
+  static void *const s_handlers[NUM_OPCODES] = {
+    &&L_OP_PUSH, &&L_OP_LOAD, &&L_OP_STORE, &&L_OP_ADD, &&L_OP_SUB,
+    &&L_OP_MUL, &&L_OP_DIV, &&L_OP_POP, &&L_OP_HALT,
+  };
+#endif
+
+  m_env->resolve_slots();
+  long *values = m_env->get_values();
+  unsigned char *defined = m_env->get_defined();
+
+  // The compiler computed the maximum stack depth, so there is no need
+  // to check for overflow.  sp points to the top of the stack; element
+  // 0 is never used, so that sp can start at the beginning of the array.
+  if (m_stack.size() < code.get_max_depth() + 1) {
+    m_stack.resize(code.get_max_depth() + 1);
+  }
+  long *sp = m_stack.data();
+
+  const Insn *start = code.get_code();
+  const Insn *pc = start;
+
+  VM_BEGIN
+
+  VM_CASE(OP_PUSH)
+    *++sp = pc->arg;
+    VM_NEXT();
+
+  VM_CASE(OP_LOAD) {
+    unsigned slot = unsigned(pc->arg);
+    if (!defined[slot]) {
+      m_env->undefined_variable(code.get_loc(unsigned(pc - start)), slot);
+    }
+    *++sp = values[slot];
+    VM_NEXT();
+  }
+
+  VM_CASE(OP_STORE) {
+    unsigned slot = unsigned(pc->arg);
+    values[slot] = *sp;
+    defined[slot] = 1;
+    VM_NEXT();
+  }
+
+  VM_CASE(OP_ADD)
+    sp--;
+    *sp = arith::add(sp[0], sp[1]);
+    VM_NEXT();
+
+  VM_CASE(OP_SUB)
+    sp--;
+    *sp = arith::sub(sp[0], sp[1]);
+    VM_NEXT();
+
+  VM_CASE(OP_MUL)
+    sp--;
+    *sp = arith::mul(sp[0], sp[1]);
+    VM_NEXT();
+
+  VM_CASE(OP_DIV)
+    sp--;
+    if (sp[1] == 0) {
+      EvaluationError::raise(code.get_loc(unsigned(pc - start)), "Division by zero");
+    }
+    *sp = arith::div(sp[0], sp[1]);
+    VM_NEXT();
+
+  VM_CASE(OP_POP)
+    sp--;
+    VM_NEXT();
+
+  VM_CASE(OP_HALT)
+    return *sp;
+
+  VM_END
+}
@@ -0,0 +1,26 @@
+#ifndef VM_H
+#define VM_H
+
+#include <vector>
+#include "bytecode.h"
+#include "env.h"
+
+// Stack virtual machine for executing Bytecode.
+class Vm {
+private:
+  Environment *m_env;
+  std::vector<long> m_stack;
+
+  // no value semantics
+  Vm(const Vm &);
+  Vm &operator=(const Vm &);
+
+public:
+  Vm(Environment *env);
+  ~Vm();
+
+  // Execute code, returning the value left on top of the stack
+  long run(const Bytecode &code);
+};
+
+#endif // VM_H